@@ -0,0 +1,492 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+#include <QCryptographicHash>
+#include <QDBusArgument>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusMetaType>
+#include <QDBusObjectPath>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDBusVariant>
+#include <QDir>
+#include <QFile>
+
+#include "cgroupmanager.h"
+#include "wineprocess.h"
+#include "wineserverlist.h"
+
+QT_USE_NAMESPACE
+
+constexpr QStringView kCgroupAccountingKey = u"cgroupAccounting";
+constexpr QStringView kCgroupLimitsKey = u"cgroupLimits";
+
+constexpr const char *kCgroupMount = "/sys/fs/cgroup";
+constexpr int kMinCpuWeight = 1;
+constexpr int kMaxCpuWeight = 10000;
+
+constexpr const char *kSystemdService = "org.freedesktop.systemd1";
+constexpr const char *kSystemdPath = "/org/freedesktop/systemd1";
+constexpr const char *kSystemdManagerInterface = "org.freedesktop.systemd1.Manager";
+
+namespace {
+
+// The (sv) and (sa(sv)) structs StartTransientUnit takes.
+struct UnitProperty
+{
+    QString name;
+    QDBusVariant value;
+};
+
+struct AuxiliaryUnit
+{
+    QString name;
+    QList<UnitProperty> properties;
+};
+
+auto operator<<(QDBusArgument &argument, const UnitProperty &property) -> QDBusArgument &
+{
+    argument.beginStructure();
+    argument << property.name << property.value;
+    argument.endStructure();
+    return argument;
+}
+
+auto operator>>(const QDBusArgument &argument, UnitProperty &property) -> const QDBusArgument &
+{
+    argument.beginStructure();
+    argument >> property.name >> property.value;
+    argument.endStructure();
+    return argument;
+}
+
+auto operator<<(QDBusArgument &argument, const AuxiliaryUnit &unit) -> QDBusArgument &
+{
+    argument.beginStructure();
+    argument << unit.name << unit.properties;
+    argument.endStructure();
+    return argument;
+}
+
+auto operator>>(const QDBusArgument &argument, AuxiliaryUnit &unit) -> const QDBusArgument &
+{
+    argument.beginStructure();
+    argument >> unit.name >> unit.properties;
+    argument.endStructure();
+    return argument;
+}
+
+}
+
+Q_DECLARE_METATYPE(UnitProperty)
+Q_DECLARE_METATYPE(AuxiliaryUnit)
+
+namespace {
+
+auto readCgroupFile(const QString &path) -> QByteArray
+{
+    QFile file { path };
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    return file.readAll();
+}
+
+auto writeCgroupFile(const QString &path, const QByteArray &value) -> bool
+{
+    // cgroupfs acts on each write() separately, so these are not buffered.
+    // O_CREAT and O_APPEND make no difference to cgroupfs, but let a plain
+    // directory stand in for it.
+    int fd = ::open(QFile::encodeName(path).constData(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        qDebug("Unable to open %s (errno=%d)", qPrintable(path), errno);
+        return false;
+    }
+    bool ok = ::write(fd, value.constData(), value.size()) == value.size();
+    if (!ok) {
+        qDebug("Unable to write '%s' to %s (errno=%d)", value.constData(), qPrintable(path), errno);
+    }
+    ::close(fd);
+    return ok;
+}
+
+// Reads a flat keyed file such as cpu.stat or memory.events.
+auto readKeyedValue(const QByteArray &data, QByteArrayView key) -> qint64
+{
+    for (const auto &line : data.split('\n')) {
+        auto space = line.indexOf(' ');
+        if (space != -1 && QByteArrayView { line }.first(space) == key) {
+            return line.sliced(space + 1).toLongLong();
+        }
+    }
+    return 0;
+}
+
+// Returns the cgroup this process runs in.
+auto ownCgroup() -> QString
+{
+    // /proc/self/cgroup holds "0::<path>" on a cgroup v2 only system.
+    for (const auto &line : readCgroupFile("/proc/self/cgroup").split('\n')) {
+        if (line.startsWith("0::")) {
+            return QDir::cleanPath(QFile::decodeName(kCgroupMount) + QFile::decodeName(line.sliced(3).trimmed()));
+        }
+    }
+    return {};
+}
+
+auto systemdCall(const char *method) -> QDBusMessage
+{
+    return QDBusMessage::createMethodCall(kSystemdService, kSystemdPath, kSystemdManagerInterface, method);
+}
+
+}
+
+CgroupManager::CgroupManager(const QString &root, WineServerListModel *listModel, QObject *parent)
+    : QObject(parent)
+    , enabled_ { settings_.value(kCgroupAccountingKey, false).toBool() }
+    , root_ { root }
+    , limits_ { settings_.value(kCgroupLimitsKey).toMap() }
+    , listModel_ { listModel }
+{
+    QObject::connect(listModel_, &WineServerListModel::clientsChanged, this, &CgroupManager::clientsChanged);
+    QObject::connect(listModel_, &WineServerListModel::serverEnded, this, &CgroupManager::serverEnded);
+
+    if (enabled_) {
+        prepareRoot();
+    }
+}
+
+auto CgroupManager::root() const -> QString
+{
+    return root_;
+}
+
+auto CgroupManager::enabled() const -> bool
+{
+    return enabled_;
+}
+
+void CgroupManager::setEnabled(bool value)
+{
+    enabled_ = value;
+    settings_.setValue(kCgroupAccountingKey, value);
+    settings_.sync();
+
+    if (value && prepareRoot()) {
+        for (int row = 0; row < listModel_->rowCount(); row++) {
+            attach(listModel_->server(row));
+        }
+    }
+}
+
+void CgroupManager::requestDelegation()
+{
+    if (delegation_ != Delegation::None) {
+        return;
+    }
+    delegation_ = Delegation::Pending;
+    scopeName_ = QString { "app-winemon-%1.scope" }.arg(getpid());
+
+    // The systemd user manager is on the session bus. It only sends
+    // JobRemoved to subscribed clients, and handles calls in order, so the
+    // signal cannot be missed once Subscribe has been sent first.
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    if (!bus.isConnected()
+            || !bus.connect(kSystemdService,
+                    kSystemdPath,
+                    kSystemdManagerInterface,
+                    "JobRemoved",
+                    this,
+                    SLOT(jobRemoved(uint, QDBusObjectPath, QString, QString)))) {
+        delegationFinished(false);
+        return;
+    }
+    bus.asyncCall(systemdCall("Subscribe"));
+
+    qDBusRegisterMetaType<UnitProperty>();
+    qDBusRegisterMetaType<QList<UnitProperty>>();
+    qDBusRegisterMetaType<AuxiliaryUnit>();
+    qDBusRegisterMetaType<QList<AuxiliaryUnit>>();
+
+    // Delegate=yes hands the scope's subtree to us, and systemd leaves it
+    // alone, which it does not promise for any group it created itself.
+    QList<UnitProperty> properties {
+        { "Description", QDBusVariant { QString { "Winemon per-prefix cgroups" } } },
+        { "PIDs", QDBusVariant { QVariant::fromValue(QList<uint> { static_cast<uint>(getpid()) }) } },
+        { "Delegate", QDBusVariant { true } },
+    };
+    QDBusMessage message = systemdCall("StartTransientUnit");
+    message << scopeName_ << QString { "fail" } << QVariant::fromValue(properties)
+            << QVariant::fromValue(QList<AuxiliaryUnit> {});
+
+    auto *watcher = new QDBusPendingCallWatcher(bus.asyncCall(message), this);
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QDBusObjectPath> reply = *call;
+        if (reply.isError() && delegation_ == Delegation::Pending) {
+            qWarning("Unable to start %s: %s", qPrintable(scopeName_), qPrintable(reply.error().message()));
+            delegationFinished(false);
+        }
+    });
+}
+
+void CgroupManager::jobRemoved(uint /*id*/, const QDBusObjectPath & /*job*/, const QString &unit, const QString &result)
+{
+    if (delegation_ == Delegation::Pending && unit == scopeName_) {
+        delegationFinished(result == "done");
+    }
+}
+
+void CgroupManager::delegationFinished(bool started)
+{
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    bus.disconnect(kSystemdService,
+            kSystemdPath,
+            kSystemdManagerInterface,
+            "JobRemoved",
+            this,
+            SLOT(jobRemoved(uint, QDBusObjectPath, QString, QString)));
+    if (bus.isConnected()) {
+        bus.asyncCall(systemdCall("Unsubscribe"));
+    }
+
+    // The scope's own group can only enable controllers for the groups below
+    // it while it has no processes itself, so this process moves into a leaf.
+    QString scope = ownCgroup();
+    QString leaf = scope + "/winemon";
+    if (!started || !scope.endsWith("/" + scopeName_) || !QDir {}.mkpath(leaf)
+            || !writeCgroupFile(leaf + "/cgroup.procs", QByteArray::number(getpid()))) {
+        qWarning("No delegated cgroup for per-prefix accounting; usage is summed from /proc instead");
+        delegation_ = Delegation::Failed;
+        return;
+    }
+    root_ = scope;
+    delegation_ = Delegation::None;
+
+    if (enabled_ && prepareRoot()) {
+        for (int row = 0; row < listModel_->rowCount(); row++) {
+            attach(listModel_->server(row));
+        }
+    }
+}
+
+auto CgroupManager::prepareRoot() -> bool
+{
+    if (rootPrepared_) {
+        return true;
+    }
+    if (root_.isEmpty()) {
+        requestDelegation();
+        return false;
+    }
+    if (!QDir {}.mkpath(root_)) {
+        qWarning("Unable to create cgroup %s", qPrintable(root_));
+        return false;
+    }
+
+    // Only the root's own subtree is ours to change; the levels above it
+    // belong to whoever delegated it. The groups still work for accounting
+    // whatever controllers are available.
+    for (const char *controller : { "+cpu", "+memory", "+io" }) {
+        writeCgroupFile(root_ + "/cgroup.subtree_control", controller);
+    }
+
+    // Remove groups left behind by an earlier run; rmdir fails on any that
+    // still have processes.
+    QDir rootDir { root_ };
+    for (const auto &entry : rootDir.entryList({ "prefix-*" }, QDir::Dirs | QDir::NoDotAndDotDot)) {
+        rootDir.rmdir(entry);
+    }
+
+    rootPrepared_ = true;
+    return true;
+}
+
+auto CgroupManager::groupPath(const WineServerData &server) const -> QString
+{
+    // A prefix path inside a sandbox is a different prefix from the same path
+    // on the host or in another sandbox.
+    QByteArray key = server.prefix.toUtf8();
+    if (server.sandboxed) {
+        key += '\n' + processMountNamespace(server.pid);
+    }
+    QByteArray hash = QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex().left(16);
+    return QDir { root_ }.absoluteFilePath("prefix-" + QString::fromLatin1(hash));
+}
+
+void CgroupManager::serverRunning(pid_t pid)
+{
+    if (!enabled_) {
+        return;
+    }
+    int row = listModel_->rowForPid(pid);
+    if (row != -1) {
+        attach(listModel_->server(row));
+    }
+}
+
+void CgroupManager::clientsChanged(const WineServerData &server)
+{
+    if (enabled_) {
+        attach(server);
+    }
+}
+
+void CgroupManager::attach(const WineServerData &server)
+{
+    if (!prepareRoot()) {
+        return;
+    }
+
+    auto attached = attached_.find(server.pid);
+    if (attached == attached_.end()) {
+        QString path = groupPath(server);
+        if (!QDir {}.mkpath(path)) {
+            qWarning("Unable to create cgroup %s", qPrintable(path));
+            return;
+        }
+        applyLimits(server.prefix, path);
+        attached = attached_.insert(server.pid, Group { .prefix = server.prefix, .path = path });
+    }
+
+    QList<pid_t> pids = server.clientPids;
+    pids.prepend(server.pid);
+    for (pid_t pid : pids) {
+        // Only one pid can be written per write().
+        if (!attached->pids.contains(pid)
+                && writeCgroupFile(attached->path + "/cgroup.procs", QByteArray::number(pid))) {
+            attached->pids.insert(pid);
+        }
+    }
+
+    // Forget clients that have exited so their pids can be reused.
+    attached->pids.intersect(QSet<pid_t> { pids.begin(), pids.end() });
+}
+
+void CgroupManager::serverEnded(const WineServerData &server)
+{
+    auto attached = attached_.find(server.pid);
+    if (attached != attached_.end()) {
+        // Fails while clients are still running. Such a group goes with the
+        // delegated scope once it is empty, and prepareRoot() removes it from
+        // a given root on the next start.
+        QDir {}.rmdir(attached->path);
+        attached_.erase(attached);
+    }
+}
+
+auto CgroupManager::usage(const WineServerData &server) const -> std::optional<CgroupUsage>
+{
+    auto attached = attached_.constFind(server.pid);
+    if (attached == attached_.cend() || !attached->pids.contains(server.pid)) {
+        return std::nullopt;
+    }
+
+    const QString &path = attached->path;
+    QByteArray memoryCurrent = readCgroupFile(path + "/memory.current");
+    QByteArray cpuStat = readCgroupFile(path + "/cpu.stat");
+    if (memoryCurrent.isEmpty() || cpuStat.isEmpty()) {
+        return std::nullopt;
+    }
+
+    CgroupUsage usage;
+    usage.cpuUs = readKeyedValue(cpuStat, "usage_usec");
+    usage.memoryBytes = memoryCurrent.trimmed().toLongLong();
+
+    // io.stat has one line per device: "MAJ:MIN rbytes=N wbytes=N ...".
+    for (const auto &line : readCgroupFile(path + "/io.stat").split('\n')) {
+        for (const auto &field : line.split(' ')) {
+            if (field.startsWith("rbytes=")) {
+                usage.ioReadBytes += field.sliced(7).toLongLong();
+            } else if (field.startsWith("wbytes=")) {
+                usage.ioWriteBytes += field.sliced(7).toLongLong();
+            }
+        }
+    }
+
+    QByteArray memoryEvents = readCgroupFile(path + "/memory.events");
+    usage.memoryHighEvents = readKeyedValue(memoryEvents, "high");
+    usage.oomKills = readKeyedValue(memoryEvents, "oom_kill");
+    return usage;
+}
+
+auto CgroupManager::members(const WineServerData &server) const -> std::optional<QList<pid_t>>
+{
+    auto attached = attached_.constFind(server.pid);
+    if (attached == attached_.cend() || !attached->pids.contains(server.pid)) {
+        return std::nullopt;
+    }
+
+    QByteArray procs = readCgroupFile(attached->path + "/cgroup.procs");
+    if (procs.isNull()) {
+        return std::nullopt;
+    }
+    QList<pid_t> result;
+    for (const auto &line : procs.split('\n')) {
+        bool ok = false;
+        auto pid = static_cast<pid_t>(line.toInt(&ok));
+        if (ok && pid != server.pid && !result.contains(pid)) {
+            result.append(pid);
+        }
+    }
+    return result;
+}
+
+auto CgroupManager::limits() const -> QVariantMap
+{
+    return limits_;
+}
+
+void CgroupManager::setLimits(const QString &prefix, const QVariantMap &limits)
+{
+    if (limits.isEmpty()) {
+        limits_.remove(prefix);
+    } else {
+        limits_.insert(prefix, limits);
+    }
+    settings_.setValue(kCgroupLimitsKey, limits_);
+    settings_.sync();
+
+    for (const auto &group : std::as_const(attached_)) {
+        if (group.prefix == prefix) {
+            applyLimits(prefix, group.path);
+        }
+    }
+}
+
+void CgroupManager::applyLimits(const QString &prefix, const QString &path) const
+{
+    QVariantMap limits = limits_.value(prefix).toMap();
+
+    qint64 memoryHigh = limits.value("memoryHigh").toLongLong();
+    writeCgroupFile(path + "/memory.high", memoryHigh > 0 ? QByteArray::number(memoryHigh) : "max");
+
+    int cpuWeight = limits.value("cpuWeight", 100).toInt();
+    writeCgroupFile(path + "/cpu.weight", QByteArray::number(std::clamp(cpuWeight, kMinCpuWeight, kMaxCpuWeight)));
+}
+
+auto CgroupManager::statistics() const -> QVariantMap
+{
+    QVariantMap result;
+    for (int row = 0; row < listModel_->rowCount(); row++) {
+        const auto &server = listModel_->server(row);
+        auto serverUsage = usage(server);
+        if (!serverUsage) {
+            continue;
+        }
+        result.insert(server.prefix,
+                QVariantMap {
+                        { "cpuUs", serverUsage->cpuUs },
+                        { "memoryBytes", serverUsage->memoryBytes },
+                        { "ioReadBytes", serverUsage->ioReadBytes },
+                        { "ioWriteBytes", serverUsage->ioWriteBytes },
+                        { "memoryHighEvents", serverUsage->memoryHighEvents },
+                        { "oomKills", serverUsage->oomKills },
+                });
+    }
+    return result;
+}
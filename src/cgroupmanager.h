@@ -0,0 +1,153 @@
+#pragma once
+
+#include <optional>
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QSettings>
+#include <QString>
+#include <QVariantMap>
+
+QT_BEGIN_NAMESPACE
+class QDBusObjectPath;
+QT_END_NAMESPACE
+
+class WineServerListModel;
+struct WineServerData;
+
+/**
+ * Resource usage of a prefix, read from its cgroup.
+ */
+struct CgroupUsage
+{
+    qint64 cpuUs {};
+    qint64 memoryBytes {};
+    qint64 ioReadBytes {};
+    qint64 ioWriteBytes {};
+    qint64 memoryHighEvents {};
+    qint64 oomKills {};
+};
+
+/**
+ * Places the wineserver and client processes of each prefix in a cgroup v2
+ * group of their own, so that the usage of a whole prefix can be read from
+ * a few files instead of summed over its processes, and so that memory.high
+ * and cpu.weight limits can be set per prefix.
+ *
+ * Unless a root directory is given, the groups are created in a transient
+ * scope that the systemd user manager starts for this process with
+ * Delegate=yes, so that only winemon writes below it. If that fails, no
+ * groups are created and usage keeps being summed from /proc. A given root
+ * must be writable and have its controllers enabled by whoever delegated it.
+ * Any directory works as the root, so a fake cgroupfs can stand in for the
+ * real one.
+ *
+ * Sandboxed servers are grouped by mount namespace as well as prefix, since
+ * the same prefix path inside and outside a sandbox names different prefixes.
+ */
+class CgroupManager : public QT_PREPEND_NAMESPACE(QObject)
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Creates a manager that puts groups under root, or in a delegated scope
+     * if root is empty.
+     */
+    CgroupManager(const QT_PREPEND_NAMESPACE(QString) & root,
+            WineServerListModel *listModel,
+            QObject *parent = nullptr);
+
+    CgroupManager(CgroupManager &) = delete;
+    CgroupManager(CgroupManager &&) = delete;
+    auto operator=(CgroupManager &) -> CgroupManager = delete;
+    auto operator=(CgroupManager &&) -> CgroupManager = delete;
+
+    /**
+     * Returns the directory the groups are created in, which is empty until
+     * the delegated scope has started.
+     */
+    [[nodiscard]] auto root() const -> QString;
+
+    /**
+     * Whether new servers and their clients are moved into per-prefix
+     * groups.
+     */
+    [[nodiscard]] auto enabled() const -> bool;
+    Q_SLOT void setEnabled(bool value);
+
+    /**
+     * Moves a newly started server into the group of its prefix.
+     */
+    Q_SLOT void serverRunning(pid_t pid);
+
+    /**
+     * Returns the usage of the group holding server, or nothing if the
+     * server is not in a group or the group cannot be read.
+     */
+    [[nodiscard]] auto usage(const WineServerData &server) const -> std::optional<CgroupUsage>;
+
+    /**
+     * Returns the processes in the group holding server other than the
+     * server itself, or nothing if the server is not in a group. Processes
+     * started by its members are in the group too.
+     */
+    [[nodiscard]] auto members(const WineServerData &server) const -> std::optional<QT_PREPEND_NAMESPACE(QList)<pid_t>>;
+
+    /**
+     * Per-prefix limits: "memoryHigh" in bytes and "cpuWeight" from 1 to
+     * 10000. Setting empty limits removes them.
+     */
+    [[nodiscard]] auto limits() const -> QT_PREPEND_NAMESPACE(QVariantMap);
+    void setLimits(const QString &prefix, const QT_PREPEND_NAMESPACE(QVariantMap) & limits);
+
+    /**
+     * Returns the usage of each prefix that has a group, keyed by prefix.
+     */
+    [[nodiscard]] auto statistics() const -> QT_PREPEND_NAMESPACE(QVariantMap);
+
+private:
+    enum class Delegation {
+        None,
+        Pending,
+        Failed,
+    };
+
+    // A group created for a server, and the processes moved into it so far.
+    // Only the server and the Wine clients found for it are ever moved.
+    struct Group
+    {
+        QString prefix;
+        QString path;
+        QSet<pid_t> pids;
+    };
+
+    void clientsChanged(const WineServerData &server);
+    void serverEnded(const WineServerData &server);
+    void requestDelegation();
+    Q_SLOT void jobRemoved(uint id,
+            const QT_PREPEND_NAMESPACE(QDBusObjectPath) & job,
+            const QString &unit,
+            const QString &result);
+    void delegationFinished(bool started);
+    auto prepareRoot() -> bool;
+    [[nodiscard]] auto groupPath(const WineServerData &server) const -> QString;
+    void attach(const WineServerData &server);
+    void applyLimits(const QString &prefix, const QString &path) const;
+
+    QT_PREPEND_NAMESPACE(QSettings) settings_;
+    bool enabled_;
+    QT_PREPEND_NAMESPACE(QString) root_;
+    bool rootPrepared_ {};
+    Delegation delegation_ = Delegation::None;
+    QT_PREPEND_NAMESPACE(QString) scopeName_;
+    QT_PREPEND_NAMESPACE(QVariantMap) limits_;
+
+    // Keyed by server pid.
+    QT_PREPEND_NAMESPACE(QHash)<pid_t, Group> attached_;
+
+    QT_PREPEND_NAMESPACE(QPointer)<WineServerListModel> listModel_;
+};
@@ -0,0 +1,353 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <csignal>
+#include <limits>
+
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QStringBuilder>
+
+#include "hookrunner.h"
+#include "wineserverlist.h"
+
+QT_USE_NAMESPACE
+
+constexpr QStringView kHooksKey = u"hooks";
+
+constexpr int kMaxRunningHooks = 4;
+constexpr int kMaxQueuedRuns = 256;
+constexpr int kDefaultTimeoutMs = 30 * 1000;
+
+// How long a hook gets to exit after SIGTERM before it is killed.
+constexpr int kKillGraceMs = 2000;
+
+// How long the shell of a hook gets to start before its payload is written,
+// and to be reaped after it is killed on exit.
+constexpr int kStartTimeoutMs = 1000;
+constexpr int kReapTimeoutMs = 100;
+
+// The same event for the same server runs each hook only once within this
+// long, should the server be reported twice.
+constexpr qint64 kDedupWindowMs = 5000;
+
+constexpr const char *kTimedOutProperty = "winemonTimedOut";
+constexpr const char *kFailedToStartProperty = "winemonFailedToStart";
+
+namespace {
+
+// Turns a payload key such as "peakRssBytes" into "WINEMON_PEAK_RSS_BYTES".
+auto environmentName(const QString &key) -> QString
+{
+    QString name { "WINEMON_" };
+    for (QChar c : key) {
+        if (c.isUpper()) {
+            name += '_';
+        }
+        name += c.toUpper();
+    }
+    return name;
+}
+
+// Signals the process group of a hook, which was made a session leader so
+// that commands started by its shell are reached too.
+void signalHook(QProcess *process, int signal)
+{
+    if (process->processId() > 0) {
+        ::kill(-static_cast<pid_t>(process->processId()), signal);
+    }
+}
+
+}
+
+auto Hook::fromVariant(const QVariantMap &map) -> Hook
+{
+    Hook hook;
+    hook.command = map.value("command").toString();
+    hook.events = map.value("events", QStringList { "start", "stop" }).toStringList();
+    hook.timeoutMs = std::max(map.value("timeoutMs", kDefaultTimeoutMs).toInt(), 0);
+    hook.minIntervalMs = std::max(map.value("minIntervalMs", 0).toInt(), 0);
+    return hook;
+}
+
+auto Hook::toVariant() const -> QVariantMap
+{
+    return {
+        { "command", command },
+        { "events", events },
+        { "timeoutMs", timeoutMs },
+        { "minIntervalMs", minIntervalMs },
+    };
+}
+
+HookRunner::HookRunner(WineServerListModel *listModel, QObject *parent)
+    : QObject(parent)
+    , listModel_ { listModel }
+{
+    // Hooks are kept as a settings array, so that they can be edited by hand:
+    // [hooks] 1\command=..., 1\events=start, size=1.
+    int count = settings_.beginReadArray(kHooksKey);
+    for (int i = 0; i < count; i++) {
+        settings_.setArrayIndex(i);
+        QVariantMap hook;
+        for (const auto &key : settings_.childKeys()) {
+            hook.insert(key, settings_.value(key));
+        }
+        hooks_.append(Hook::fromVariant(hook));
+    }
+    settings_.endArray();
+
+    clock_.start();
+    dispatchTimer_.setSingleShot(true);
+    QObject::connect(&dispatchTimer_, &QTimer::timeout, this, &HookRunner::dispatch);
+    QObject::connect(listModel_, &WineServerListModel::serverEnded, this, &HookRunner::serverEnded);
+    QObject::connect(listModel_, &WineServerListModel::prewarmedServerUsed, this, &HookRunner::prewarmedServerUsed);
+}
+
+HookRunner::~HookRunner()
+{
+    // Hooks still running are asked to stop, along with anything they
+    // started, rather than left behind. Nothing waits for them to exit: only
+    // the shell itself is killed, and given a moment to be reaped.
+    for (auto *process : std::as_const(running_)) {
+        process->disconnect(this);
+        signalHook(process, SIGTERM);
+    }
+    for (auto *process : std::as_const(running_)) {
+        process->kill();
+        process->waitForFinished(kReapTimeoutMs);
+    }
+}
+
+auto HookRunner::hooks() const -> QVariantList
+{
+    QVariantList result;
+    for (const auto &hook : hooks_) {
+        result.append(hook.toVariant());
+    }
+    return result;
+}
+
+void HookRunner::setHooks(const QVariantList &hooks)
+{
+    hooks_.clear();
+    for (const auto &hook : hooks) {
+        hooks_.append(Hook::fromVariant(hook.toMap()));
+    }
+    settings_.remove(kHooksKey);
+    settings_.beginWriteArray(kHooksKey, static_cast<int>(hooks_.size()));
+    for (int i = 0; i < hooks_.size(); i++) {
+        settings_.setArrayIndex(i);
+        const QVariantMap hook = hooks_.at(i).toVariant();
+        for (auto it = hook.cbegin(); it != hook.cend(); ++it) {
+            settings_.setValue(it.key(), it.value());
+        }
+    }
+    settings_.endArray();
+    settings_.sync();
+
+    generation_++;
+    pending_.clear();
+    busyHooks_.clear();
+    lastStartedMs_.clear();
+    lastEnqueuedMs_.clear();
+}
+
+auto HookRunner::statistics() const -> QVariantMap
+{
+    return {
+        { "started", started_ },
+        { "succeeded", succeeded_ },
+        { "failed", failed_ },
+        { "failedToStart", failedToStart_ },
+        { "timedOut", timedOut_ },
+        { "deduplicated", deduplicated_ },
+        { "dropped", dropped_ },
+        { "running", running_.size() },
+        { "queued", pending_.size() },
+    };
+}
+
+void HookRunner::serverRunning(pid_t pid)
+{
+    // A prewarmed server only counts as started once a client uses it.
+    int row = listModel_->rowForPid(pid);
+    if (row != -1 && !listModel_->server(row).prewarmed) {
+        enqueue("start", listModel_->server(row));
+    }
+}
+
+void HookRunner::prewarmedServerUsed(const WineServerData &server)
+{
+    enqueue("start", server);
+}
+
+void HookRunner::serverEnded(const WineServerData &server)
+{
+    // Nothing was started in a prewarmed server that was never used.
+    if (!server.prewarmed || server.prewarmUsed) {
+        enqueue("stop", server);
+    }
+}
+
+void HookRunner::enqueue(const QString &event, const WineServerData &server)
+{
+    if (hooks_.isEmpty()) {
+        return;
+    }
+
+    QVariantMap payload {
+        { "event", event },
+        { "pid", server.pid },
+        { "prefix", server.prefix },
+        { "version", server.package },
+        { "server", server.exe },
+        { "sandboxed", server.sandboxed },
+        { "prewarmed", server.prewarmed },
+        { "startedMs", server.startedMs },
+        { "peakRssBytes", server.peakRss },
+        { "peakClients", server.peakClients },
+    };
+    if (event == "stop") {
+        payload.insert("stoppedMs", QDateTime::currentMSecsSinceEpoch());
+    }
+
+    qint64 now = clock_.elapsed();
+    lastEnqueuedMs_.removeIf(
+            [now](QHash<QString, qint64>::iterator it) { return now - it.value() >= kDedupWindowMs; });
+
+    for (int hook = 0; hook < hooks_.size(); hook++) {
+        if (hooks_.at(hook).command.isEmpty() || !hooks_.at(hook).events.contains(event)) {
+            continue;
+        }
+        // Keyed by server rather than prefix, so that a server started again
+        // in the same prefix straight away still runs its hooks.
+        QString key = QString::number(hook) % '\n' % event % '\n' % QString::number(server.pid) % '\n'
+                % QString::number(server.startedMs);
+        if (lastEnqueuedMs_.contains(key)) {
+            deduplicated_++;
+            continue;
+        }
+        if (pending_.size() >= kMaxQueuedRuns) {
+            qWarning("Hook queue is full, dropping %s hook for wineserver pid=%d", qPrintable(event), server.pid);
+            dropped_++;
+            continue;
+        }
+        pending_.append(Job { .hook = hook, .event = event, .payload = payload });
+        lastEnqueuedMs_.insert(key, now);
+    }
+    dispatch();
+}
+
+void HookRunner::dispatch()
+{
+    // Start whatever is allowed to run, oldest first, and come back when the
+    // next rate limited run is due.
+    qint64 now = clock_.elapsed();
+    qint64 nextDueMs = std::numeric_limits<qint64>::max();
+    for (auto it = pending_.begin(); it != pending_.end() && running_.size() < kMaxRunningHooks;) {
+        if (busyHooks_.contains(it->hook)) {
+            ++it;
+            continue;
+        }
+        auto lastStarted = lastStartedMs_.constFind(it->hook);
+        if (lastStarted != lastStartedMs_.cend()) {
+            qint64 dueMs = *lastStarted + hooks_.at(it->hook).minIntervalMs;
+            if (dueMs > now) {
+                nextDueMs = std::min(nextDueMs, dueMs);
+                ++it;
+                continue;
+            }
+        }
+        Job job = *it;
+        it = pending_.erase(it);
+        start(job);
+    }
+
+    if (nextDueMs != std::numeric_limits<qint64>::max()) {
+        dispatchTimer_.start(static_cast<int>(nextDueMs - now));
+    }
+}
+
+void HookRunner::start(const Job &job)
+{
+    const Hook &hook = hooks_.at(job.hook);
+    QString command = hook.command;
+    auto *process = new QProcess(this);
+    process->setProgram("/bin/sh");
+    process->setArguments({ "-c", command });
+    process->setStandardOutputFile(QProcess::nullDevice());
+    process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    process->setChildProcessModifier([] { setsid(); });
+
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    for (auto it = job.payload.cbegin(); it != job.payload.cend(); ++it) {
+        environment.insert(environmentName(it.key()), it.value().toString());
+    }
+    process->setProcessEnvironment(environment);
+
+    int hookIndex = job.hook;
+    quint64 generation = generation_;
+    auto finished = [this, process, hookIndex, generation](int exitCode, QProcess::ExitStatus exitStatus) {
+        finish(process, hookIndex, generation, exitStatus == QProcess::NormalExit && exitCode == 0);
+    };
+    auto errorOccurred = [this, process, command, hookIndex, generation](QProcess::ProcessError error) {
+        if (error == QProcess::FailedToStart) {
+            qWarning("Unable to start hook '%s'", qPrintable(command));
+            process->setProperty(kFailedToStartProperty, true);
+            finish(process, hookIndex, generation, false);
+        }
+    };
+    QObject::connect(process, &QProcess::finished, this, finished);
+    QObject::connect(process, &QProcess::errorOccurred, this, errorOccurred);
+    if (hook.timeoutMs > 0) {
+        QTimer::singleShot(hook.timeoutMs, process, [process, command] {
+            qWarning("Hook '%s' timed out", qPrintable(command));
+            process->setProperty(kTimedOutProperty, true);
+            signalHook(process, SIGTERM);
+            QTimer::singleShot(kKillGraceMs, process, [process] { signalHook(process, SIGKILL); });
+        });
+    }
+
+    running_.insert(process);
+    busyHooks_.insert(hookIndex);
+    lastStartedMs_.insert(hookIndex, clock_.elapsed());
+
+    // A shell that failed to start has been finished by errorOccurred by the
+    // time this returns. One still starting buffers what is written to it.
+    process->start();
+    if (!process->waitForStarted(kStartTimeoutMs) && process->state() == QProcess::NotRunning) {
+        return;
+    }
+    started_++;
+    process->write(QJsonDocument { QJsonObject::fromVariantMap(job.payload) }.toJson(QJsonDocument::Compact));
+    process->closeWriteChannel();
+}
+
+void HookRunner::finish(QProcess *process, int hook, quint64 generation, bool succeeded)
+{
+    if (!running_.remove(process)) {
+        return;
+    }
+
+    if (process->property(kFailedToStartProperty).toBool()) {
+        failedToStart_++;
+    } else if (process->property(kTimedOutProperty).toBool()) {
+        timedOut_++;
+    } else if (succeeded) {
+        succeeded_++;
+    } else {
+        failed_++;
+    }
+
+    if (generation == generation_) {
+        busyHooks_.remove(hook);
+    }
+    process->deleteLater();
+
+    // This can run from within start() when the shell fails to start, so
+    // dispatching has to wait for the loop there to finish.
+    QMetaObject::invokeMethod(this, &HookRunner::dispatch, Qt::QueuedConnection);
+}
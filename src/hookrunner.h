@@ -0,0 +1,137 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QSettings>
+#include <QStringList>
+#include <QTimer>
+#include <QVariantList>
+#include <QVariantMap>
+
+QT_BEGIN_NAMESPACE
+class QProcess;
+QT_END_NAMESPACE
+
+class WineServerListModel;
+struct WineServerData;
+
+/**
+ * A command run when servers start or stop.
+ */
+struct Hook
+{
+    /**
+     * Reads a hook from a settings map with the keys "command" (run with
+     * /bin/sh -c), "events" (a list of "start" and "stop", both if unset),
+     * "timeoutMs" and "minIntervalMs".
+     */
+    static auto fromVariant(const QT_PREPEND_NAMESPACE(QVariantMap) & map) -> Hook;
+    [[nodiscard]] auto toVariant() const -> QT_PREPEND_NAMESPACE(QVariantMap);
+
+    QT_PREPEND_NAMESPACE(QString) command;
+    QT_PREPEND_NAMESPACE(QStringList) events;
+    int timeoutMs {};
+
+    // Runs of the hook start at least this far apart; events in between
+    // wait in the queue.
+    int minIntervalMs {};
+};
+
+/**
+ * Runs the configured hooks for server start and stop events, without
+ * blocking the event loop.
+ *
+ * Each run gets the server's details in WINEMON_* environment variables and
+ * as a JSON object on stdin. Runs wait in a bounded queue and at most a few
+ * run at once, with no more than one run of each hook at a time. The same
+ * event for the same server runs a hook only once within a few seconds, and
+ * hooks that run for longer than their timeout are terminated. Prewarmed
+ * servers only count as started once a client uses them; those that are
+ * never used run no hooks at all. Servers already running when monitoring
+ * starts run no start hooks.
+ */
+class HookRunner : public QT_PREPEND_NAMESPACE(QObject)
+{
+    Q_OBJECT
+
+public:
+    explicit HookRunner(WineServerListModel *listModel, QObject *parent = nullptr);
+    ~HookRunner() override;
+
+    HookRunner(HookRunner &) = delete;
+    HookRunner(HookRunner &&) = delete;
+    auto operator=(HookRunner &) -> HookRunner = delete;
+    auto operator=(HookRunner &&) -> HookRunner = delete;
+
+    /**
+     * Returns the configured hooks; see Hook::fromVariant for the keys.
+     */
+    [[nodiscard]] auto hooks() const -> QT_PREPEND_NAMESPACE(QVariantList);
+
+    /**
+     * Replaces the configured hooks. Queued runs of the old hooks are
+     * dropped; running ones are left to finish.
+     */
+    void setHooks(const QT_PREPEND_NAMESPACE(QVariantList) & hooks);
+
+    /**
+     * Returns counts of runs started, succeeded, failed, timed out and
+     * failed to start, and of events deduplicated or dropped because the
+     * queue was full.
+     */
+    [[nodiscard]] auto statistics() const -> QT_PREPEND_NAMESPACE(QVariantMap);
+
+    /**
+     * Queues the start hooks for a newly started server. Called once the
+     * server is known to be prewarmed or not, and not for servers found
+     * running when monitoring starts.
+     */
+    Q_SLOT void serverRunning(pid_t pid);
+
+private:
+    struct Job
+    {
+        int hook;
+        QT_PREPEND_NAMESPACE(QString) event;
+        QT_PREPEND_NAMESPACE(QVariantMap) payload;
+    };
+
+    void prewarmedServerUsed(const WineServerData &server);
+    void serverEnded(const WineServerData &server);
+    void enqueue(const QString &event, const WineServerData &server);
+    Q_SLOT void dispatch();
+    void start(const Job &job);
+    void finish(QT_PREPEND_NAMESPACE(QProcess) * process, int hook, quint64 generation, bool succeeded);
+
+    QT_PREPEND_NAMESPACE(QSettings) settings_;
+    QT_PREPEND_NAMESPACE(QList)<Hook> hooks_;
+
+    // Bumped by setHooks(), so that runs of replaced hooks do not affect the
+    // bookkeeping of the new ones.
+    quint64 generation_ {};
+
+    QT_PREPEND_NAMESPACE(QList)<Job> pending_;
+    QT_PREPEND_NAMESPACE(QSet)<QProcess *> running_;
+    QT_PREPEND_NAMESPACE(QSet)<int> busyHooks_;
+    QT_PREPEND_NAMESPACE(QHash)<int, qint64> lastStartedMs_;
+
+    // When each hook was last queued for an event and server, keyed by
+    // "<hook>\n<event>\n<pid>\n<startedMs>".
+    QT_PREPEND_NAMESPACE(QHash)<QString, qint64> lastEnqueuedMs_;
+    QT_PREPEND_NAMESPACE(QElapsedTimer) clock_;
+    QT_PREPEND_NAMESPACE(QTimer) dispatchTimer_;
+
+    qint64 started_ {};
+    qint64 succeeded_ {};
+    qint64 failed_ {};
+    qint64 timedOut_ {};
+    qint64 failedToStart_ {};
+    qint64 deduplicated_ {};
+    qint64 dropped_ {};
+
+    QT_PREPEND_NAMESPACE(QPointer)<WineServerListModel> listModel_;
+};
@@ -4,7 +4,7 @@
 
 #include "winemanager.h"
 
-auto setupInstance(WineManager &manager) -> bool;
+auto setupInstance() -> bool;
 
 auto main(int argc, char *argv[]) -> int
 {
@@ -14,15 +14,23 @@ auto main(int argc, char *argv[]) -> int
     QCoreApplication::setApplicationName("Winemon");
     QGuiApplication::setQuitOnLastWindowClosed(false);
 
-    WineManager manager;
-    if (!setupInstance(manager)) {
+    // The instance is claimed before the manager exists, since constructing
+    // it starts prewarming and page cache warming, which an instance that is
+    // only here to raise the existing one must not do.
+    if (!setupInstance()) {
         return 0;
     }
 
+    WineManager manager;
+    auto connection = QDBusConnection::sessionBus();
+    if (connection.isConnected()) {
+        connection.registerObject("/", &manager, QDBusConnection::ExportAllSlots);
+    }
+
     return QApplication::exec();
 }
 
-auto setupInstance(WineManager &manager) -> bool
+auto setupInstance() -> bool
 {
     static constexpr const char *kServiceName = "io.jchw.winemon";
     auto connection = QDBusConnection::sessionBus();
@@ -45,6 +53,5 @@ auto setupInstance(WineManager &manager) -> bool
         qDebug("Invoked existing instance via DBus");
         return false;
     }
-    connection.registerObject("/", &manager, QDBusConnection::ExportAllSlots);
     return true;
 }
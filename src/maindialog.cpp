@@ -1,6 +1,13 @@
+#include <QDateTime>
+#include <QHideEvent>
 #include <QListView>
+#include <QTreeView>
 
+#include "cgroupmanager.h"
 #include "maindialog.h"
+#include "pagecachewarmer.h"
+#include "prewarmmanager.h"
+#include "sessionhistory.h"
 #include "winemanager.h"
 #include "wineserverlist.h"
 
@@ -13,27 +20,122 @@ MainDialog::MainDialog(WineManager *manager, QWidget *parent) : QDialog { parent
     ui.serverStartedNotificationCheckBox->setChecked(manager->shouldNotifyOnStart());
     ui.serverStoppedNotificationCheckBox->setChecked(manager->shouldNotifyOnStop());
     ui.alwaysShowCheckBox->setChecked(manager->shouldAlwaysShow());
+    ui.prewarmCheckBox->setChecked(manager->prewarmManager()->enabled());
+    ui.pageCacheCheckBox->setChecked(manager->pageCacheWarmer()->enabled());
+    ui.cgroupCheckBox->setChecked(manager->cgroupManager()->enabled());
     QObject::connect(ui.closeButton, &QAbstractButton::clicked, this, &QDialog::hide);
     QObject::connect(ui.quitButton, &QAbstractButton::clicked, qApp, &QApplication::quit);
     QObject::connect(ui.killServerButton, &QAbstractButton::clicked, this, &MainDialog::killServer);
     QObject::connect(ui.taskManagerButton, &QAbstractButton::clicked, this, &MainDialog::startTaskManager);
+    QObject::connect(ui.pinPrefixButton, &QAbstractButton::clicked, this, &MainDialog::togglePinnedPrefix);
+    QObject::connect(
+            ui.serverView->selectionModel(), &QItemSelectionModel::selectionChanged, this, &MainDialog::updatePinButton);
+    updatePinButton();
+    QObject::connect(ui.serverView, &QTreeView::collapsed, this, [this](const QModelIndex &index) {
+        manager_->listModel()->discardChildren(index);
+    });
     QObject::connect(ui.serverStartedNotificationCheckBox, &QAbstractButton::clicked, manager, &WineManager::setShouldNotifyOnStart);
     QObject::connect(ui.serverStoppedNotificationCheckBox, &QAbstractButton::clicked, manager, &WineManager::setShouldNotifyOnStop);
     QObject::connect(ui.alwaysShowCheckBox, &QAbstractButton::clicked, manager, &WineManager::setShouldAlwaysShow);
+    QObject::connect(ui.prewarmCheckBox, &QAbstractButton::clicked, manager->prewarmManager(), &PrewarmManager::setEnabled);
+    QObject::connect(
+            ui.pageCacheCheckBox, &QAbstractButton::clicked, manager->pageCacheWarmer(), &PageCacheWarmer::setEnabled);
+    QObject::connect(ui.cgroupCheckBox, &QAbstractButton::clicked, manager->cgroupManager(), &CgroupManager::setEnabled);
+    QObject::connect(ui.tabWidget, &QTabWidget::currentChanged, this, [this] {
+        if (ui.tabWidget->currentWidget() == ui.historyTab) {
+            refreshHistory();
+        }
+    });
+}
+
+void MainDialog::hideEvent(QHideEvent *event)
+{
+    QDialog::hideEvent(event);
+    if (!event->spontaneous()) {
+        // Stop sampling client processes nobody is looking at.
+        ui.serverView->collapseAll();
+        manager_->listModel()->discardChildren();
+        emit hidden();
+    }
+}
+
+auto MainDialog::selectedServerRows() const -> QList<int>
+{
+    // A selected client process stands for its server.
+    QList<int> rows;
+    for (const auto &selectedRow : ui.serverView->selectionModel()->selectedRows()) {
+        int row = manager_->listModel()->serverRow(selectedRow);
+        if (row != -1 && !rows.contains(row)) {
+            rows.append(row);
+        }
+    }
+    return rows;
 }
 
 void MainDialog::killServer()
 {
-    auto selectedRows = ui.serverView->selectionModel()->selectedRows();
-    for (const auto &selectedRow : selectedRows) {
-        manager_->listModel()->server(selectedRow.row()).kill();
+    for (int row : selectedServerRows()) {
+        manager_->listModel()->server(row).kill();
     }
 }
 
 void MainDialog::startTaskManager()
 {
-    auto selectedRows = ui.serverView->selectionModel()->selectedRows();
-    for (const auto &selectedRow : selectedRows) {
-        manager_->listModel()->server(selectedRow.row()).taskmgr();
+    for (int row : selectedServerRows()) {
+        manager_->listModel()->server(row).taskmgr();
+    }
+}
+
+void MainDialog::togglePinnedPrefix()
+{
+    auto *prewarmManager = manager_->prewarmManager();
+    for (int row : selectedServerRows()) {
+        const auto &server = manager_->listModel()->server(row);
+        if (server.sandboxed) {
+            continue;
+        }
+        if (prewarmManager->isPinned(server.prefix)) {
+            prewarmManager->unpinPrefix(server.prefix);
+        } else {
+            prewarmManager->pinPrefix(server.prefix, server.exe);
+        }
+    }
+    updatePinButton();
+}
+
+void MainDialog::updatePinButton()
+{
+    // Sandboxed servers cannot be prewarmed from outside their sandbox.
+    auto selectedRows = selectedServerRows();
+    bool pinned = false;
+    bool pinnable = false;
+    for (int row : selectedRows) {
+        const auto &server = manager_->listModel()->server(row);
+        if (!server.sandboxed) {
+            pinned = manager_->prewarmManager()->isPinned(server.prefix);
+            pinnable = true;
+            break;
+        }
+    }
+    ui.pinPrefixButton->setText(pinned ? "Unpin Prefix" : "Pin Prefix");
+    ui.pinPrefixButton->setEnabled(pinnable);
+}
+
+void MainDialog::refreshHistory()
+{
+    static constexpr qint64 kWeekMs = 7LL * 24 * 60 * 60 * 1000;
+    static constexpr double kSecondsPerHour = 3600.0;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    auto usage = manager_->history()->usageByPrefix(now - kWeekMs, now);
+
+    ui.historyView->setRowCount(static_cast<int>(usage.size()));
+    for (int row = 0; row < usage.size(); row++) {
+        const auto &prefixUsage = usage.at(row);
+        QString prefixText = prefixUsage.prefix.isEmpty() ? QString { "(default prefix)" } : prefixUsage.prefix;
+        QString hoursText = QString::number(static_cast<double>(prefixUsage.seconds) / kSecondsPerHour, 'f', 1);
+        ui.historyView->setItem(row, 0, new QTableWidgetItem(prefixText));
+        ui.historyView->setItem(row, 1, new QTableWidgetItem(hoursText));
+        ui.historyView->setItem(row, 2, new QTableWidgetItem(QString::number(prefixUsage.sessions)));
     }
 }
@@ -16,8 +16,21 @@ public:
 
     Q_SLOT void killServer();
     Q_SLOT void startTaskManager();
+    Q_SLOT void refreshHistory();
+    Q_SLOT void togglePinnedPrefix();
+
+    /**
+     * Sent whenever the dialog is hidden, including when it is closed.
+     */
+    Q_SIGNAL void hidden();
+
+protected:
+    void hideEvent(QT_PREPEND_NAMESPACE(QHideEvent) * event) override;
 
 private:
+    [[nodiscard]] auto selectedServerRows() const -> QList<int>;
+    void updatePinButton();
+
     QT_PREPEND_NAMESPACE(QPointer)<WineManager> manager_;
 
     QT_PREPEND_NAMESPACE(Ui::MainDialog) ui;
@@ -0,0 +1,370 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSaveFile>
+
+#include "pagecachewarmer.h"
+#include "wineprocess.h"
+#include "wineserverlist.h"
+
+QT_USE_NAMESPACE
+
+constexpr QStringView kPageCacheWarmingKey = u"pageCacheWarming";
+constexpr QStringView kPageCacheBudgetKey = u"pageCacheBudgetMiB";
+
+constexpr int kSampleIntervalMs = 60000;
+constexpr int kWarmThreads = 4;
+constexpr qint64 kDefaultBudgetMiB = 1024;
+constexpr qint64 kMiB = 1024 * 1024;
+constexpr qsizetype kMaxRecordedFiles = 20000;
+
+struct PageCacheWarmer::WarmJob
+{
+    QStringList files;
+    QElapsedTimer timer;
+    std::atomic<qsizetype> next {};
+    std::atomic<qint64> budget {};
+    std::atomic<qint64> requestedBytes {};
+    std::atomic<qint64> cachedBytes {};
+
+    // Which files were passed to readahead(); each entry is only written by
+    // the worker that took its index.
+    std::vector<char> requested;
+    std::atomic<int> warmedFiles {};
+    std::atomic<int> skippedFiles {};
+    std::atomic<int> workers {};
+    std::atomic<bool> stop {};
+};
+
+namespace {
+
+auto residentBytes(int fd, qint64 size) -> qint64
+{
+    static const qint64 kPageSize = sysconf(_SC_PAGESIZE);
+
+    void *map = mmap(nullptr, static_cast<size_t>(size), PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) { // NOLINT(cppcoreguidelines-pro-type-cstyle-cast)
+        return 0;
+    }
+
+    std::vector<unsigned char> pages(static_cast<size_t>((size + kPageSize - 1) / kPageSize));
+    qint64 resident = 0;
+    if (mincore(map, static_cast<size_t>(size), pages.data()) == 0) {
+        resident = std::count_if(pages.begin(), pages.end(), [](unsigned char page) { return (page & 1) != 0; })
+                * kPageSize;
+    }
+    munmap(map, static_cast<size_t>(size));
+    return std::min(resident, size);
+}
+
+void readMappedFiles(pid_t pid, QSet<QString> &files)
+{
+    QFile mapsFile { QString { "/proc/%1/maps" }.arg(pid) };
+    if (!mapsFile.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    // Each line is "address perms offset dev inode pathname"; only the
+    // pathnames of real files are interesting.
+    for (const auto &line : mapsFile.readAll().split('\n')) {
+        auto slash = line.indexOf('/');
+        if (slash == -1) {
+            continue;
+        }
+        QByteArray path = line.sliced(slash).trimmed();
+        if (path.endsWith(" (deleted)") || path.startsWith("/dev/") || path.startsWith("/memfd:")) {
+            continue;
+        }
+        if (files.size() >= kMaxRecordedFiles) {
+            return;
+        }
+        files.insert(QFile::decodeName(path));
+    }
+}
+
+}
+
+PageCacheWarmer::PageCacheWarmer(const QString &directory, WineServerListModel *listModel, QObject *parent)
+    : QObject(parent)
+    , enabled_ { settings_.value(kPageCacheWarmingKey, false).toBool() }
+    , directory_ { directory }
+    , listModel_ { listModel }
+{
+    pool_.setMaxThreadCount(kWarmThreads);
+    pool_.setThreadPriority(QThread::LowPriority);
+    sampleTimer_.setInterval(kSampleIntervalMs);
+    QObject::connect(&sampleTimer_, &QTimer::timeout, this, &PageCacheWarmer::sampleMappedFiles);
+    QObject::connect(listModel_, &QAbstractItemModel::rowsInserted, this, &PageCacheWarmer::updateSampling);
+    QObject::connect(listModel_, &QAbstractItemModel::rowsRemoved, this, &PageCacheWarmer::updateSampling);
+    QObject::connect(listModel_, &WineServerListModel::clientsChanged, this, &PageCacheWarmer::clientsChanged);
+    QObject::connect(listModel_, &WineServerListModel::serverEnded, this, &PageCacheWarmer::serverEnded);
+}
+
+PageCacheWarmer::~PageCacheWarmer()
+{
+    for (const auto &job : std::as_const(warming_)) {
+        job->stop = true;
+    }
+    pool_.waitForDone();
+}
+
+auto PageCacheWarmer::enabled() const -> bool
+{
+    return enabled_;
+}
+
+void PageCacheWarmer::setEnabled(bool value)
+{
+    enabled_ = value;
+    settings_.setValue(kPageCacheWarmingKey, value);
+    settings_.sync();
+    updateSampling();
+}
+
+void PageCacheWarmer::updateSampling()
+{
+    if (enabled_ && listModel_->rowCount() > 0) {
+        if (!sampleTimer_.isActive()) {
+            sampleTimer_.start();
+        }
+    } else {
+        sampleTimer_.stop();
+    }
+}
+
+void PageCacheWarmer::sampleMappedFiles()
+{
+    QSet<QString> changed;
+    for (int row = 0; row < listModel_->rowCount(); row++) {
+        const auto &server = listModel_->server(row);
+        if (recordMappedFiles(server)) {
+            changed.insert(server.prefix);
+        }
+    }
+
+    for (const auto &prefix : changed) {
+        saveList(prefix);
+    }
+}
+
+auto PageCacheWarmer::recordMappedFiles(const WineServerData &server) -> bool
+{
+    // The files a sandboxed server maps are paths inside its sandbox, and
+    // would be warmed on the host.
+    if (server.sandboxed) {
+        return false;
+    }
+
+    auto files = recorded_.find(server.prefix);
+    if (files == recorded_.end()) {
+        files = recorded_.insert(server.prefix, loadList(server.prefix));
+    }
+
+    auto before = files->size();
+    readMappedFiles(server.pid, *files);
+    for (pid_t clientPid : server.clientPids) {
+        readMappedFiles(clientPid, *files);
+    }
+    return files->size() != before;
+}
+
+void PageCacheWarmer::clientsChanged(const WineServerData &server)
+{
+    // Clients are read as soon as they are seen, so that programs that exit
+    // before the next periodic sample are recorded too.
+    if (enabled_ && recordMappedFiles(server)) {
+        saveList(server.prefix);
+    }
+}
+
+void PageCacheWarmer::serverEnded(const WineServerData &server)
+{
+    if (!server.sandboxed) {
+        recorded_.remove(server.prefix);
+    }
+}
+
+auto PageCacheWarmer::warmPrefix(const QString &prefix) -> bool
+{
+    if (warming_.contains(prefix)) {
+        return false;
+    }
+
+    QSet<QString> files = recorded_.contains(prefix) ? recorded_.value(prefix) : loadList(prefix);
+    if (files.isEmpty()) {
+        return false;
+    }
+
+    auto job = std::make_shared<WarmJob>();
+    job->files = QStringList(files.begin(), files.end());
+    job->files.sort();
+    job->requested.resize(static_cast<size_t>(job->files.size()));
+    job->budget = settings_.value(kPageCacheBudgetKey, kDefaultBudgetMiB).toLongLong() * kMiB;
+    job->workers = kWarmThreads;
+    job->timer.start();
+    warming_.insert(prefix, job);
+
+    for (int i = 0; i < kWarmThreads; i++) {
+        pool_.start([this, job, prefix] {
+            while (!job->stop) {
+                auto index = job->next++;
+                if (index >= job->files.size()) {
+                    break;
+                }
+
+                QByteArray path = QFile::encodeName(job->files.at(index));
+                int fd = ::open(path.constData(), O_RDONLY | O_CLOEXEC);
+                if (fd == -1) {
+                    continue;
+                }
+                struct stat st = {};
+                if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                    qint64 cached = residentBytes(fd, st.st_size);
+                    qint64 missing = st.st_size - cached;
+                    job->cachedBytes += cached;
+
+                    // Take the file's share of the budget only if all of it
+                    // fits; a file that does not is skipped, and smaller ones
+                    // after it may still be warmed.
+                    qint64 budget = job->budget.load();
+                    while (missing > 0 && budget >= missing
+                            && !job->budget.compare_exchange_weak(budget, budget - missing)) {
+                    }
+                    if (missing > 0 && budget < missing) {
+                        job->skippedFiles++;
+                    } else if (missing > 0) {
+                        readahead(fd, 0, static_cast<size_t>(st.st_size));
+                        job->requested[static_cast<size_t>(index)] = 1;
+                        job->requestedBytes += missing;
+                        job->warmedFiles++;
+                    }
+                }
+                ::close(fd);
+            }
+
+            if (--job->workers == 0) {
+                // readahead() only queues the reads, so what was requested
+                // is not necessarily what is resident now.
+                qint64 residentAfter = 0;
+                for (size_t i = 0; i < job->requested.size() && !job->stop; i++) {
+                    if (job->requested[i] == 0) {
+                        continue;
+                    }
+                    int fd = ::open(QFile::encodeName(job->files.at(static_cast<qsizetype>(i))).constData(),
+                            O_RDONLY | O_CLOEXEC);
+                    struct stat st = {};
+                    if (fd != -1 && fstat(fd, &st) == 0 && st.st_size > 0) {
+                        residentAfter += residentBytes(fd, st.st_size);
+                    }
+                    if (fd != -1) {
+                        ::close(fd);
+                    }
+                }
+
+                QVariantMap result {
+                    { "files", static_cast<qlonglong>(job->files.size()) },
+                    { "warmedFiles", job->warmedFiles.load() },
+                    { "requestedBytes", static_cast<qlonglong>(job->requestedBytes.load()) },
+                    { "residentBytes", static_cast<qlonglong>(residentAfter) },
+                    { "cachedBytes", static_cast<qlonglong>(job->cachedBytes.load()) },
+                    { "elapsedMs", static_cast<qlonglong>(job->timer.elapsed()) },
+                    { "skippedFiles", job->skippedFiles.load() },
+                };
+                QMetaObject::invokeMethod(this, [this, prefix, result] { finishWarm(prefix, result); });
+            }
+        });
+    }
+    return true;
+}
+
+void PageCacheWarmer::finishWarm(const QString &prefix, const QVariantMap &result)
+{
+    warming_.remove(prefix);
+    results_.insert(prefix, result);
+
+    qint64 requestedBytes = result.value("requestedBytes").toLongLong();
+    qint64 residentBytes = result.value("residentBytes").toLongLong();
+    qint64 cachedBytes = result.value("cachedBytes").toLongLong();
+    qint64 elapsedMs = result.value("elapsedMs").toLongLong();
+    qInfo("Warmed page cache for prefix %s: requested %lld MiB, %lld MiB of it resident (%lld MiB already cached) "
+          "in %lld ms",
+            qPrintable(prefix),
+            requestedBytes / kMiB,
+            residentBytes / kMiB,
+            cachedBytes / kMiB,
+            elapsedMs);
+    emit prefixWarmed(prefix, requestedBytes, residentBytes, cachedBytes, elapsedMs);
+}
+
+void PageCacheWarmer::recordLaunch(const WineServerData &server)
+{
+    qint64 startedMs = processStartTimeMs(server.pid);
+    if (server.sandboxed || startedMs <= 0) {
+        return;
+    }
+
+    // From the server process starting to it accepting connections, which
+    // is spent loading the binary, its libraries and the prefix's registry.
+    qint64 launchMs = std::max<qint64>(0, QDateTime::currentMSecsSinceEpoch() - startedMs);
+    Launches &launches = results_.contains(server.prefix) ? warmedLaunches_ : coldLaunches_;
+    launches.count++;
+    launches.totalMs += launchMs;
+}
+
+auto PageCacheWarmer::statistics() const -> QVariantMap
+{
+    return {
+        { "prefixes", results_ },
+        { "warmedLaunches", warmedLaunches_.count },
+        { "meanWarmedLaunchMs", warmedLaunches_.count > 0 ? warmedLaunches_.totalMs / warmedLaunches_.count : 0 },
+        { "coldLaunches", coldLaunches_.count },
+        { "meanColdLaunchMs", coldLaunches_.count > 0 ? coldLaunches_.totalMs / coldLaunches_.count : 0 },
+    };
+}
+
+auto PageCacheWarmer::listPath(const QString &prefix) const -> QString
+{
+    QByteArray hash = QCryptographicHash::hash(prefix.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QDir { directory_ }.absoluteFilePath(QString::fromLatin1(hash) + ".list");
+}
+
+auto PageCacheWarmer::loadList(const QString &prefix) const -> QSet<QString>
+{
+    QSet<QString> files;
+    QFile listFile { listPath(prefix) };
+    if (!listFile.open(QIODevice::ReadOnly)) {
+        return files;
+    }
+    for (const auto &line : listFile.readAll().split('\n')) {
+        if (!line.isEmpty() && !line.startsWith('#')) {
+            files.insert(QFile::decodeName(line));
+        }
+    }
+    return files;
+}
+
+void PageCacheWarmer::saveList(const QString &prefix)
+{
+    QDir {}.mkpath(directory_);
+    QSaveFile listFile { listPath(prefix) };
+    if (!listFile.open(QIODevice::WriteOnly)) {
+        qWarning("Unable to save page cache list for prefix %s", qPrintable(prefix));
+        return;
+    }
+    listFile.write("# " + prefix.toUtf8() + '\n');
+    for (const auto &path : recorded_.value(prefix)) {
+        listFile.write(QFile::encodeName(path) + '\n');
+    }
+    listFile.commit();
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <memory>
+
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QSettings>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVariantMap>
+
+class WineServerListModel;
+struct WineServerData;
+
+/**
+ * Records which files the processes of each prefix map, and replays them
+ * into the page cache ahead of a launch so that the first start of a large
+ * prefix after a reboot does not wait on cold reads.
+ *
+ * Recording reads /proc/<pid>/maps of each client when it is first seen, and
+ * of each running server and its clients once a minute. Replay runs
+ * readahead() over the recorded files on a small thread pool, skipping pages
+ * that are already resident and files that no longer fit in the I/O budget.
+ */
+class PageCacheWarmer : public QT_PREPEND_NAMESPACE(QObject)
+{
+    Q_OBJECT
+
+public:
+    PageCacheWarmer(const QT_PREPEND_NAMESPACE(QString) & directory,
+            WineServerListModel *listModel,
+            QObject *parent = nullptr);
+    ~PageCacheWarmer() override;
+
+    PageCacheWarmer(PageCacheWarmer &) = delete;
+    PageCacheWarmer(PageCacheWarmer &&) = delete;
+    auto operator=(PageCacheWarmer &) -> PageCacheWarmer = delete;
+    auto operator=(PageCacheWarmer &&) -> PageCacheWarmer = delete;
+
+    /**
+     * Whether files are recorded while servers run and replayed at login.
+     */
+    [[nodiscard]] auto enabled() const -> bool;
+    Q_SLOT void setEnabled(bool value);
+
+    /**
+     * Starts warming the recorded files of prefix in the background. Returns
+     * false if nothing has been recorded for it or it is already warming.
+     */
+    auto warmPrefix(const QString &prefix) -> bool;
+
+    /**
+     * Called for each server started by somebody else once Winemon is up, to
+     * time its start against whether its prefix had been warmed.
+     */
+    void recordLaunch(const WineServerData &server);
+
+    /**
+     * Returns the result of the last warm of each prefix under "prefixes",
+     * and the count and mean start time of servers launched in a warmed
+     * prefix and in one that was not warmed.
+     */
+    [[nodiscard]] auto statistics() const -> QT_PREPEND_NAMESPACE(QVariantMap);
+
+    /**
+     * Sent when warming a prefix finishes. requestedBytes were passed to
+     * readahead(), residentBytes of those were resident once the warm
+     * finished, cachedBytes were already resident beforehand, and elapsedMs
+     * is how long warming took.
+     */
+    Q_SIGNAL void prefixWarmed(const QString &prefix,
+            qint64 requestedBytes,
+            qint64 residentBytes,
+            qint64 cachedBytes,
+            qint64 elapsedMs);
+
+private:
+    struct WarmJob;
+
+    struct Launches
+    {
+        qint64 count {};
+        qint64 totalMs {};
+    };
+
+    Q_SLOT void sampleMappedFiles();
+    Q_SLOT void updateSampling();
+    auto recordMappedFiles(const WineServerData &server) -> bool;
+    void clientsChanged(const WineServerData &server);
+    void serverEnded(const WineServerData &server);
+    void finishWarm(const QString &prefix, const QT_PREPEND_NAMESPACE(QVariantMap) & result);
+
+    [[nodiscard]] auto listPath(const QString &prefix) const -> QString;
+    [[nodiscard]] auto loadList(const QString &prefix) const -> QT_PREPEND_NAMESPACE(QSet)<QString>;
+    void saveList(const QString &prefix);
+
+    QT_PREPEND_NAMESPACE(QSettings) settings_;
+    bool enabled_;
+    QT_PREPEND_NAMESPACE(QString) directory_;
+    QT_PREPEND_NAMESPACE(QPointer)<WineServerListModel> listModel_;
+
+    // Files recorded so far for prefixes with running servers.
+    QT_PREPEND_NAMESPACE(QHash)<QString, QSet<QString>> recorded_;
+
+    QT_PREPEND_NAMESPACE(QHash)<QString, std::shared_ptr<WarmJob>> warming_;
+    QT_PREPEND_NAMESPACE(QVariantMap) results_;
+    Launches warmedLaunches_;
+    Launches coldLaunches_;
+    QT_PREPEND_NAMESPACE(QTimer) sampleTimer_;
+    QT_PREPEND_NAMESPACE(QThreadPool) pool_;
+};
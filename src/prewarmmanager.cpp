@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QProcess>
+#include <QProcessEnvironment>
+
+#include "prewarmmanager.h"
+#include "sessionhistory.h"
+#include "wineprocess.h"
+#include "wineserverlist.h"
+
+QT_USE_NAMESPACE
+
+constexpr QStringView kPrewarmEnabledKey = u"prewarmEnabled";
+constexpr QStringView kPinnedPrefixesKey = u"pinnedPrefixes";
+constexpr QStringView kPrewarmCountKey = u"prewarmCount";
+constexpr QStringView kPrewarmHitsKey = u"prewarmHits";
+
+// How long a prewarmed wineserver waits for a client before exiting.
+constexpr int kPersistSeconds = 600;
+constexpr int kPrewarmIntervalMs = 60 * 60 * 1000;
+constexpr qint64 kPendingTimeoutNs = 30LL * 1000 * 1000 * 1000;
+
+constexpr qint64 kDayMs = 24LL * 60 * 60 * 1000;
+constexpr qint64 kHistoryDays = 400;
+constexpr qint64 kPredictionDays = 28;
+constexpr qint64 kPredictionWindowMs = 60LL * 60 * 1000;
+constexpr int kMinPredictionScore = 3;
+constexpr int kMaxPredictedPrefixes = 2;
+
+PrewarmManager::PrewarmManager(SessionHistory *history, WineServerListModel *listModel, QObject *parent)
+    : QObject(parent)
+    , enabled_ { settings_.value(kPrewarmEnabledKey, false).toBool() }
+    , pinned_ { settings_.value(kPinnedPrefixesKey).toMap() }
+    , prewarms_ { settings_.value(kPrewarmCountKey, 0).toLongLong() }
+    , hits_ { settings_.value(kPrewarmHitsKey, 0).toLongLong() }
+    , history_ { history }
+    , listModel_ { listModel }
+{
+    clock_.start();
+    prewarmTimer_.setInterval(kPrewarmIntervalMs);
+    QObject::connect(&prewarmTimer_, &QTimer::timeout, this, &PrewarmManager::prewarmNow);
+    QObject::connect(
+            listModel_, &WineServerListModel::prewarmedServerUsed, this, &PrewarmManager::prewarmedServerUsed);
+    if (enabled_) {
+        prewarmTimer_.start();
+    }
+}
+
+auto PrewarmManager::enabled() const -> bool
+{
+    return enabled_;
+}
+
+void PrewarmManager::setEnabled(bool value)
+{
+    enabled_ = value;
+    settings_.setValue(kPrewarmEnabledKey, value);
+    settings_.sync();
+
+    if (value) {
+        prewarmTimer_.start();
+        prewarmNow();
+    } else {
+        prewarmTimer_.stop();
+    }
+}
+
+auto PrewarmManager::pinnedPrefixes() const -> QVariantMap
+{
+    return pinned_;
+}
+
+auto PrewarmManager::isPinned(const QString &prefix) const -> bool
+{
+    return pinned_.contains(prefix);
+}
+
+void PrewarmManager::pinPrefix(const QString &prefix, const QString &serverExe)
+{
+    pinned_.insert(prefix, serverExe);
+    settings_.setValue(kPinnedPrefixesKey, pinned_);
+    settings_.sync();
+}
+
+void PrewarmManager::unpinPrefix(const QString &prefix)
+{
+    pinned_.remove(prefix);
+    settings_.setValue(kPinnedPrefixesKey, pinned_);
+    settings_.sync();
+}
+
+auto PrewarmManager::candidatePrefixes() const -> QStringList
+{
+    QStringList result = pinned_.keys();
+    for (const auto &prefix : predictedPrefixes().keys()) {
+        if (!result.contains(prefix)) {
+            result.append(prefix);
+        }
+    }
+    return result;
+}
+
+void PrewarmManager::prewarmNow()
+{
+    if (!enabled_) {
+        return;
+    }
+
+    expirePending();
+    for (auto it = pinned_.cbegin(); it != pinned_.cend(); ++it) {
+        if (!hasServer(it.key())) {
+            start(it.key(), it.value().toString());
+        }
+    }
+
+    auto predicted = predictedPrefixes();
+    for (auto it = predicted.cbegin(); it != predicted.cend(); ++it) {
+        if (!hasServer(it.key())) {
+            start(it.key(), it.value());
+        }
+    }
+}
+
+auto PrewarmManager::prewarmPrefix(const QString &prefix) -> bool
+{
+    QString serverExe = serverExeForPrefix(prefix);
+    if (serverExe.isEmpty()) {
+        return false;
+    }
+    if (!hasServer(prefix)) {
+        start(prefix, serverExe);
+    }
+    return true;
+}
+
+void PrewarmManager::start(const QString &prefix, const QString &serverExe)
+{
+    if (!QFileInfo { serverExe }.isExecutable()) {
+        qDebug("Not prewarming prefix %s: %s is not executable", qPrintable(prefix), qPrintable(serverExe));
+        return;
+    }
+
+    QProcess process;
+    process.setProgram(serverExe);
+    process.setArguments({ QString { "-p%1" }.arg(kPersistSeconds) });
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    if (prefix.isEmpty()) {
+        environment.remove("WINEPREFIX");
+    } else {
+        environment.insert("WINEPREFIX", prefix);
+    }
+    process.setProcessEnvironment(environment);
+    if (!process.startDetached()) {
+        qWarning("Unable to start %s to prewarm prefix %s", qPrintable(serverExe), qPrintable(prefix));
+        return;
+    }
+
+    qInfo("Prewarming wineserver for prefix %s", qPrintable(prefix));
+    pending_.insert(prefix,
+            PendingPrewarm {
+                    .exe = serverExe,
+                    .startedNs = clock_.nsecsElapsed(),
+                    .startedMs = QDateTime::currentMSecsSinceEpoch(),
+            });
+    prewarms_++;
+    settings_.setValue(kPrewarmCountKey, prewarms_);
+}
+
+auto PrewarmManager::claim(pid_t pid) -> bool
+{
+    expirePending();
+    if (pending_.isEmpty()) {
+        return false;
+    }
+
+    QString prefix = QString::fromUtf8(processEnvironmentValue(pid, "WINEPREFIX"));
+    auto it = pending_.find(prefix);
+    if (it == pending_.end()) {
+        return false;
+    }
+
+    // The time from starting the server to it accepting connections is a
+    // cold start of this prefix, which the first client will not wait for.
+    PrewarmTiming timing { .startedMs = it->startedMs, .readyMs = QDateTime::currentMSecsSinceEpoch() };
+    pending_.erase(it);
+    unused_.insert(pid, timing);
+    listModel_->setPrewarmed(pid);
+    qInfo("Prewarmed wineserver pid=%d for prefix %s in %lld ms",
+            pid,
+            qPrintable(prefix),
+            timing.readyMs - timing.startedMs);
+    return true;
+}
+
+void PrewarmManager::recordColdStart(pid_t pid)
+{
+    qint64 startedMs = processStartTimeMs(pid);
+    if (startedMs <= 0) {
+        return;
+    }
+    coldStarts_++;
+    coldStartTotalMs_ += std::max<qint64>(0, QDateTime::currentMSecsSinceEpoch() - startedMs);
+}
+
+void PrewarmManager::expirePending()
+{
+    // Forget prewarms whose server never showed up, e.g. because it failed.
+    qint64 now = clock_.nsecsElapsed();
+    pending_.removeIf([now](QHash<QString, PendingPrewarm>::iterator it) {
+        return now - it->startedNs > kPendingTimeoutNs;
+    });
+}
+
+auto PrewarmManager::release(pid_t pid) -> bool
+{
+    return unused_.remove(pid);
+}
+
+void PrewarmManager::prewarmedServerUsed(const WineServerData &server)
+{
+    // Without the prewarm, the first client would have waited for a cold
+    // start of the server; with it, it only waited if it started before the
+    // server was ready.
+    auto timing = unused_.constFind(server.pid);
+    qint64 clientStartedMs = 0;
+    for (pid_t clientPid : server.clientPids) {
+        qint64 startedMs = processStartTimeMs(clientPid);
+        if (startedMs > 0 && (clientStartedMs == 0 || startedMs < clientStartedMs)) {
+            clientStartedMs = startedMs;
+        }
+    }
+    if (timing != unused_.cend() && clientStartedMs > 0) {
+        qint64 coldMs = timing->readyMs - timing->startedMs;
+        qint64 waitedMs = std::clamp(timing->readyMs - clientStartedMs, qint64 { 0 }, coldMs);
+        measuredHits_++;
+        savedTotalMs_ += coldMs - waitedMs;
+        prewarmStartTotalMs_ += coldMs;
+    }
+    unused_.remove(server.pid);
+    hits_++;
+    settings_.setValue(kPrewarmHitsKey, hits_);
+    settings_.sync();
+    qInfo("Prewarmed wineserver for prefix %s was used", qPrintable(server.prefix));
+}
+
+auto PrewarmManager::statistics() const -> QVariantMap
+{
+    return {
+        { "prewarms", prewarms_ },
+        { "hits", hits_ },
+        { "pinnedPrefixes", static_cast<qlonglong>(pinned_.size()) },
+        { "coldStarts", coldStarts_ },
+        { "meanColdStartMs", coldStarts_ > 0 ? coldStartTotalMs_ / coldStarts_ : 0 },
+        { "measuredHits", measuredHits_ },
+        { "meanPrewarmStartMs", measuredHits_ > 0 ? prewarmStartTotalMs_ / measuredHits_ : 0 },
+        { "savedMs", savedTotalMs_ },
+        { "meanSavedMs", measuredHits_ > 0 ? savedTotalMs_ / measuredHits_ : 0 },
+    };
+}
+
+auto PrewarmManager::hasServer(const QString &prefix) const -> bool
+{
+    if (pending_.contains(prefix)) {
+        return true;
+    }
+
+    // The prefix of a sandboxed server is a path inside its sandbox, which
+    // may well be a different directory on the host.
+    for (int row = 0; row < listModel_->rowCount(); row++) {
+        const auto &server = listModel_->server(row);
+        if (!server.sandboxed && server.prefix == prefix) {
+            return true;
+        }
+    }
+    return false;
+}
+
+auto PrewarmManager::serverExeForPrefix(const QString &prefix) const -> QString
+{
+    if (pinned_.contains(prefix)) {
+        return pinned_.value(prefix).toString();
+    }
+    for (int row = 0; row < listModel_->rowCount(); row++) {
+        const auto &server = listModel_->server(row);
+        if (!server.sandboxed && server.prefix == prefix) {
+            return server.exe;
+        }
+    }
+
+    // Use whichever binary the prefix was last used with.
+    QHash<quint32, bool> matches;
+    quint32 exeId = 0;
+    bool found = false;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    history_->forEachSession(now - kHistoryDays * kDayMs, now, [&](const SessionRecord &record) {
+        auto match = matches.find(record.prefixId);
+        if (match == matches.end()) {
+            match = matches.insert(record.prefixId, history_->string(record.prefixId) == prefix);
+        }
+        if (match.value()) {
+            exeId = record.exeId;
+            found = true;
+        }
+    });
+    return found ? history_->string(exeId) : QString {};
+}
+
+auto PrewarmManager::predictedPrefixes() const -> QHash<QString, QString>
+{
+    // Score prefixes by how often they were started around this time of day
+    // over the last few weeks, and always include the last used prefix.
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 offsetMs = QDateTime::currentDateTime().offsetFromUtc() * 1000LL;
+    qint64 nowOfDay = (now + offsetMs) % kDayMs;
+
+    QHash<quint32, int> scores;
+    QHash<quint32, quint32> exes;
+    quint32 lastPrefixId = 0;
+    bool haveLast = false;
+    history_->forEachSession(now - kPredictionDays * kDayMs, now, [&](const SessionRecord &record) {
+        qint64 distance = std::abs((record.startMs + offsetMs) % kDayMs - nowOfDay);
+        if (std::min(distance, kDayMs - distance) <= kPredictionWindowMs) {
+            scores[record.prefixId]++;
+        }
+        exes[record.prefixId] = record.exeId;
+        lastPrefixId = record.prefixId;
+        haveLast = true;
+    });
+
+    QList<quint32> ranked;
+    for (auto it = scores.cbegin(); it != scores.cend(); ++it) {
+        if (it.value() >= kMinPredictionScore) {
+            ranked.append(it.key());
+        }
+    }
+    std::sort(ranked.begin(), ranked.end(), [&](quint32 a, quint32 b) { return scores.value(a) > scores.value(b); });
+    ranked.resize(std::min<qsizetype>(ranked.size(), kMaxPredictedPrefixes));
+    if (haveLast) {
+        ranked.append(lastPrefixId);
+    }
+
+    QHash<QString, QString> result;
+    for (quint32 prefixId : ranked) {
+        result.insert(history_->string(prefixId), history_->string(exes.value(prefixId)));
+    }
+    return result;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QSettings>
+#include <QStringList>
+#include <QTimer>
+#include <QVariantMap>
+
+class SessionHistory;
+class WineServerListModel;
+struct WineServerData;
+
+/**
+ * Starts persistent wineservers (wineserver -p) ahead of time for prefixes
+ * that are pinned or that the session history predicts will be used soon,
+ * so that launching a program in them does not have to wait for the server
+ * to start.
+ */
+class PrewarmManager : public QT_PREPEND_NAMESPACE(QObject)
+{
+    Q_OBJECT
+
+public:
+    PrewarmManager(SessionHistory *history, WineServerListModel *listModel, QObject *parent = nullptr);
+
+    PrewarmManager(PrewarmManager &) = delete;
+    PrewarmManager(PrewarmManager &&) = delete;
+    auto operator=(PrewarmManager &) -> PrewarmManager = delete;
+    auto operator=(PrewarmManager &&) -> PrewarmManager = delete;
+
+    [[nodiscard]] auto enabled() const -> bool;
+    Q_SLOT void setEnabled(bool value);
+
+    /**
+     * Pinned prefixes, mapping each prefix to the wineserver binary to
+     * prewarm it with.
+     */
+    [[nodiscard]] auto pinnedPrefixes() const -> QT_PREPEND_NAMESPACE(QVariantMap);
+    [[nodiscard]] auto isPinned(const QString &prefix) const -> bool;
+    void pinPrefix(const QString &prefix, const QString &serverExe);
+    void unpinPrefix(const QString &prefix);
+
+    /**
+     * Returns the pinned prefixes and the prefixes predicted to be used
+     * soon.
+     */
+    [[nodiscard]] auto candidatePrefixes() const -> QT_PREPEND_NAMESPACE(QStringList);
+
+    /**
+     * Prewarms all pinned and predicted prefixes that do not have a running
+     * server. Does nothing if prewarming is disabled.
+     */
+    Q_SLOT void prewarmNow();
+
+    /**
+     * Prewarms a single prefix, regardless of whether prewarming is enabled.
+     * Returns false if no wineserver binary is known for the prefix.
+     */
+    auto prewarmPrefix(const QString &prefix) -> bool;
+
+    /**
+     * Called for each new server; returns true if it is one we started.
+     */
+    auto claim(pid_t pid) -> bool;
+
+    /**
+     * Called for each server started by somebody else once Winemon is up,
+     * to measure how long a wineserver takes to start cold.
+     */
+    void recordColdStart(pid_t pid);
+
+    /**
+     * Called when a server stops; returns true if it was prewarmed and no
+     * client ever used it.
+     */
+    auto release(pid_t pid) -> bool;
+
+    /**
+     * Returns counts of prewarms and of hits, prewarmed servers that a
+     * client went on to use. Since Winemon started, it also returns the mean
+     * time from start to accepting connections of servers that were not
+     * prewarmed ("meanColdStartMs") and of prewarmed servers that were used
+     * ("meanPrewarmStartMs"). "savedMs" and "meanSavedMs" are the part of
+     * that start the first client of each hit did not have to wait for,
+     * measured against the client's own start time.
+     */
+    [[nodiscard]] auto statistics() const -> QT_PREPEND_NAMESPACE(QVariantMap);
+
+private:
+    struct PendingPrewarm
+    {
+        QString exe;
+        qint64 startedNs;
+        qint64 startedMs;
+    };
+
+    // When a prewarmed server was started, and when it accepted connections.
+    struct PrewarmTiming
+    {
+        qint64 startedMs;
+        qint64 readyMs;
+    };
+
+    void start(const QString &prefix, const QString &serverExe);
+    void expirePending();
+    void prewarmedServerUsed(const WineServerData &server);
+    [[nodiscard]] auto serverExeForPrefix(const QString &prefix) const -> QString;
+    [[nodiscard]] auto predictedPrefixes() const -> QT_PREPEND_NAMESPACE(QHash)<QString, QString>;
+    [[nodiscard]] auto hasServer(const QString &prefix) const -> bool;
+
+    QT_PREPEND_NAMESPACE(QSettings) settings_;
+    bool enabled_;
+    QT_PREPEND_NAMESPACE(QVariantMap) pinned_;
+    qint64 prewarms_;
+    qint64 hits_;
+    qint64 coldStarts_ {};
+    qint64 coldStartTotalMs_ {};
+    qint64 measuredHits_ {};
+    qint64 prewarmStartTotalMs_ {};
+    qint64 savedTotalMs_ {};
+
+    QT_PREPEND_NAMESPACE(QPointer)<SessionHistory> history_;
+    QT_PREPEND_NAMESPACE(QPointer)<WineServerListModel> listModel_;
+    QT_PREPEND_NAMESPACE(QHash)<QString, PendingPrewarm> pending_;
+    QT_PREPEND_NAMESPACE(QHash)<pid_t, PrewarmTiming> unused_;
+    QT_PREPEND_NAMESPACE(QElapsedTimer) clock_;
+    QT_PREPEND_NAMESPACE(QTimer) prewarmTimer_;
+};
@@ -0,0 +1,499 @@
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+
+#include "schedulingpolicy.h"
+#include "wineserverlist.h"
+
+QT_USE_NAMESPACE
+
+constexpr QStringView kPrefixRulesKey = u"prefixRules";
+
+// From linux/ioprio.h, which is not always installed.
+constexpr int kIoprioWhoProcess = 1;
+constexpr int kIoprioClassShift = 13;
+constexpr int kIoprioClassNone = 0;
+constexpr int kIoprioClassRealtime = 1;
+constexpr int kIoprioClassBestEffort = 2;
+constexpr int kIoprioClassIdle = 3;
+constexpr int kIoprioMaxLevel = 7;
+
+// Applied to every prefix other than the foreground prefix while one is set.
+constexpr int kBackgroundNice = 10;
+constexpr int kBackgroundIoLevel = 7;
+
+namespace {
+
+auto parseIoClass(const QString &name) -> std::optional<int>
+{
+    if (name == "none") {
+        return kIoprioClassNone;
+    }
+    if (name == "realtime") {
+        return kIoprioClassRealtime;
+    }
+    if (name == "best-effort") {
+        return kIoprioClassBestEffort;
+    }
+    if (name == "idle") {
+        return kIoprioClassIdle;
+    }
+    return std::nullopt;
+}
+
+auto ioClassName(int ioClass) -> QString
+{
+    switch (ioClass) {
+    case kIoprioClassRealtime:
+        return "realtime";
+    case kIoprioClassBestEffort:
+        return "best-effort";
+    case kIoprioClassIdle:
+        return "idle";
+    default:
+        return "none";
+    }
+}
+
+auto parseCpuList(const QString &list) -> QList<int>
+{
+    QList<int> cpus;
+    for (const auto &range : list.split(',', Qt::SkipEmptyParts)) {
+        auto bounds = range.trimmed().split('-');
+        bool firstOk = false;
+        bool lastOk = false;
+        int first = bounds.first().toInt(&firstOk);
+        int last = bounds.size() == 2 ? bounds.last().toInt(&lastOk) : first;
+        if (!firstOk || (bounds.size() == 2 && !lastOk) || bounds.size() > 2 || first < 0 || last < first
+                || last >= CPU_SETSIZE) {
+            qWarning("Ignoring invalid CPU range '%s'", qPrintable(range));
+            continue;
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.append(cpu);
+        }
+    }
+    return cpus;
+}
+
+auto formatCpuList(const QList<int> &cpus) -> QString
+{
+    QStringList ranges;
+    for (qsizetype i = 0; i < cpus.size();) {
+        qsizetype j = i;
+        while (j + 1 < cpus.size() && cpus.at(j + 1) == cpus.at(j) + 1) {
+            j++;
+        }
+        ranges.append(i == j ? QString::number(cpus.at(i)) : QString { "%1-%2" }.arg(cpus.at(i)).arg(cpus.at(j)));
+        i = j + 1;
+    }
+    return ranges.join(',');
+}
+
+auto autogroupPath(pid_t pid) -> QString
+{
+    return QString { "/proc/%1/autogroup" }.arg(pid);
+}
+
+// The file reads "/autogroup-<id> nice <n>".
+auto readAutogroup(const QString &path) -> QList<QByteArray>
+{
+    QFile file { path };
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    return file.readLine().trimmed().split(' ');
+}
+
+auto niceLimit(pid_t pid) -> int
+{
+    // Without CAP_SYS_NICE, a process can only be given nice levels down to
+    // 20 - RLIMIT_NICE, whoever sets them.
+    static constexpr int kMaxNice = 19;
+    static constexpr rlim_t kNiceRange = 20;
+    struct rlimit limit = {};
+    if (prlimit(pid, RLIMIT_NICE, nullptr, &limit) != 0) {
+        return kMaxNice;
+    }
+    return static_cast<int>(kNiceRange - std::min(limit.rlim_cur, kNiceRange * 2));
+}
+
+auto processTasks(pid_t pid) -> QList<pid_t>
+{
+    QList<pid_t> tids;
+    QDir taskDir { QString { "/proc/%1/task" }.arg(pid) };
+    for (const auto &task : taskDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        tids.append(static_cast<pid_t>(task.toInt()));
+    }
+    return tids;
+}
+
+}
+
+auto SchedulingPolicyManager::readSettings(pid_t pid, const ThreadSettings &fields, bool autogroupNice)
+        -> std::optional<ProcessSettings>
+{
+    // Nice levels, I/O priorities and affinity are per thread, and Wine
+    // gives some threads their own, so each thread is read separately.
+    ProcessSettings settings;
+    for (pid_t tid : processTasks(pid)) {
+        ThreadSettings thread;
+        bool ok = true;
+        if (fields.nice) {
+            errno = 0;
+            int nice = getpriority(PRIO_PROCESS, tid);
+            ok = nice != -1 || errno == 0;
+            thread.nice = nice;
+        }
+        if (ok && fields.ioprio) {
+            long ioprio = syscall(SYS_ioprio_get, kIoprioWhoProcess, tid);
+            ok = ioprio != -1;
+            thread.ioprio = static_cast<int>(ioprio);
+        }
+        if (ok && fields.cpus) {
+            cpu_set_t cpuSet;
+            ok = sched_getaffinity(tid, sizeof(cpuSet), &cpuSet) == 0;
+            thread.cpus = cpuSet;
+        }
+
+        // A thread that exited while being read is left out.
+        if (ok) {
+            settings.threads.insert(tid, thread);
+        }
+    }
+    if (!settings.threads.contains(pid)) {
+        return std::nullopt;
+    }
+
+    if (autogroupNice) {
+        auto autogroup = readAutogroup(autogroupPath(pid));
+        if (autogroup.size() < 3) {
+            return std::nullopt;
+        }
+        settings.autogroupNice = autogroup.at(2).toInt();
+    }
+    return settings;
+}
+
+void SchedulingPolicyManager::writeSettings(pid_t pid, const ProcessSettings &settings)
+{
+    // Threads started since the settings were read inherit them from the
+    // thread that started them; threads that have exited since are skipped.
+    bool niceFailed = false;
+    bool ioprioFailed = false;
+    bool affinityFailed = false;
+    for (auto it = settings.threads.cbegin(); it != settings.threads.cend(); ++it) {
+        pid_t tid = it.key();
+        const ThreadSettings &thread = it.value();
+        if (thread.nice && !niceFailed && setpriority(PRIO_PROCESS, tid, *thread.nice) == -1 && errno != ESRCH) {
+            qDebug("Unable to set nice level %d for pid %d (errno=%d)", *thread.nice, pid, errno);
+            niceFailed = true;
+        }
+        if (thread.ioprio && !ioprioFailed && syscall(SYS_ioprio_set, kIoprioWhoProcess, tid, *thread.ioprio) == -1
+                && errno != ESRCH) {
+            qDebug("Unable to set I/O priority for pid %d (errno=%d)", pid, errno);
+            ioprioFailed = true;
+        }
+        if (thread.cpus && !affinityFailed && sched_setaffinity(tid, sizeof(*thread.cpus), &*thread.cpus) == -1
+                && errno != ESRCH) {
+            qDebug("Unable to set CPU affinity for pid %d (errno=%d)", pid, errno);
+            affinityFailed = true;
+        }
+    }
+
+    if (settings.autogroupNice) {
+        QFile file { autogroupPath(pid) };
+        if (!file.open(QIODevice::WriteOnly) || file.write(QByteArray::number(*settings.autogroupNice)) == -1) {
+            qDebug("Unable to set autogroup nice level of pid %d: %s", pid, qPrintable(file.errorString()));
+        }
+    }
+}
+
+auto SchedulingPolicyManager::applyRule(pid_t pid, const PrefixRule &rule, bool ownSession)
+        -> std::optional<ProcessSettings>
+{
+    ThreadSettings target;
+    target.nice = rule.nice;
+    if (rule.ioClass) {
+        int level = *rule.ioClass == kIoprioClassNone ? 0 : rule.ioLevel;
+        target.ioprio = (*rule.ioClass << kIoprioClassShift) | level;
+    }
+    if (!rule.cpus.isEmpty()) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (int cpu : rule.cpus) {
+            CPU_SET(cpu, &cpuSet);
+        }
+        target.cpus = cpuSet;
+    }
+
+    // The autogroup is shared by the whole session, which for processes we
+    // did not start may be a terminal or the desktop, and always is for
+    // processes that share winemon's own autogroup.
+    static const QList<QByteArray> kOwnAutogroup = readAutogroup("/proc/self/autogroup");
+    bool setAutogroup = false;
+    if (rule.autogroupNice && ownSession) {
+        auto autogroup = readAutogroup(autogroupPath(pid));
+        setAutogroup = !autogroup.isEmpty() && !kOwnAutogroup.isEmpty() && autogroup.first() != kOwnAutogroup.first();
+    }
+
+    std::optional<ProcessSettings> original = readSettings(pid, target, setAutogroup);
+    if (!original) {
+        return std::nullopt;
+    }
+
+    // Raising the nice level of a thread is only done if it can be lowered
+    // back again later.
+    if (target.nice) {
+        int limit = niceLimit(pid);
+        bool restorable = std::all_of(original->threads.cbegin(), original->threads.cend(), [&](const auto &thread) {
+            return *thread.nice >= *target.nice || *thread.nice >= limit;
+        });
+        if (!restorable) {
+            qDebug("Not changing nice level of pid %d, it could not be restored", pid);
+            niceSkipped_++;
+            target.nice.reset();
+            for (auto &thread : original->threads) {
+                thread.nice.reset();
+            }
+        }
+    }
+
+    ProcessSettings update;
+    for (auto it = original->threads.cbegin(); it != original->threads.cend(); ++it) {
+        update.threads.insert(it.key(), target);
+    }
+    if (setAutogroup) {
+        update.autogroupNice = rule.autogroupNice;
+    }
+    writeSettings(pid, update);
+    return original;
+}
+
+auto PrefixRule::fromVariant(const QVariantMap &map) -> PrefixRule
+{
+    PrefixRule rule;
+    if (map.contains("nice")) {
+        rule.nice = std::clamp(map.value("nice").toInt(), -20, 19);
+    }
+    if (map.contains("ioClass")) {
+        rule.ioClass = parseIoClass(map.value("ioClass").toString());
+    }
+    rule.ioLevel = std::clamp(map.value("ioLevel", rule.ioLevel).toInt(), 0, kIoprioMaxLevel);
+    rule.cpus = parseCpuList(map.value("cpus").toString());
+    if (map.contains("autogroupNice")) {
+        rule.autogroupNice = std::clamp(map.value("autogroupNice").toInt(), -20, 19);
+    }
+    return rule;
+}
+
+auto PrefixRule::toVariant() const -> QVariantMap
+{
+    QVariantMap map;
+    if (nice) {
+        map.insert("nice", *nice);
+    }
+    if (ioClass) {
+        map.insert("ioClass", ioClassName(*ioClass));
+        map.insert("ioLevel", ioLevel);
+    }
+    if (!cpus.isEmpty()) {
+        map.insert("cpus", formatCpuList(cpus));
+    }
+    if (autogroupNice) {
+        map.insert("autogroupNice", *autogroupNice);
+    }
+    return map;
+}
+
+SchedulingPolicyManager::SchedulingPolicyManager(WineServerListModel *listModel, QObject *parent)
+    : QObject(parent)
+    , listModel_ { listModel }
+{
+    const QVariantMap rules = settings_.value(kPrefixRulesKey).toMap();
+    for (auto it = rules.cbegin(); it != rules.cend(); ++it) {
+        rules_.insert(it.key(), PrefixRule::fromVariant(it.value().toMap()));
+    }
+
+    // Without CAP_SYS_NICE, a nice level can only be lowered back to values
+    // RLIMIT_NICE allows, which by default excludes the usual 0.
+    if (int limit = niceLimit(getpid()); limit > 0) {
+        qInfo("RLIMIT_NICE only allows restoring nice levels of %d or above; nice levels of Wine processes below "
+              "that are left alone, so background prefixes only get a lower I/O priority",
+                limit);
+    }
+
+    QObject::connect(listModel_, &WineServerListModel::clientsChanged, this, &SchedulingPolicyManager::clientsChanged);
+    QObject::connect(listModel_, &WineServerListModel::serverEnded, this, &SchedulingPolicyManager::serverEnded);
+}
+
+auto SchedulingPolicyManager::rules() const -> QVariantMap
+{
+    QVariantMap result;
+    for (auto it = rules_.cbegin(); it != rules_.cend(); ++it) {
+        result.insert(it.key(), it.value().toVariant());
+    }
+    return result;
+}
+
+void SchedulingPolicyManager::setRule(const QString &prefix, const QVariantMap &rule)
+{
+    if (rule.isEmpty()) {
+        rules_.remove(prefix);
+    } else {
+        rules_.insert(prefix, PrefixRule::fromVariant(rule));
+    }
+    saveRules();
+    reapplyAll();
+}
+
+void SchedulingPolicyManager::saveRules()
+{
+    settings_.setValue(kPrefixRulesKey, rules());
+    settings_.sync();
+}
+
+auto SchedulingPolicyManager::statistics() const -> QVariantMap
+{
+    qsizetype adjusted = 0;
+    for (const auto &processes : applied_) {
+        adjusted += processes.size();
+    }
+    int limit = niceLimit(getpid());
+    return {
+        { "adjustedProcesses", static_cast<qlonglong>(adjusted) },
+        { "niceLimit", limit },
+        { "niceRestorable", limit <= 0 },
+        { "niceSkipped", niceSkipped_ },
+    };
+}
+
+auto SchedulingPolicyManager::hasForegroundPrefix() const -> bool
+{
+    return haveForeground_;
+}
+
+auto SchedulingPolicyManager::foregroundPrefix() const -> QString
+{
+    return foregroundPrefix_;
+}
+
+void SchedulingPolicyManager::setForegroundPrefix(const QString &prefix)
+{
+    haveForeground_ = true;
+    foregroundPrefix_ = prefix;
+    qInfo("Foreground prefix is now %s", qPrintable(prefix));
+    reapplyAll();
+}
+
+void SchedulingPolicyManager::clearForegroundPrefix()
+{
+    if (!haveForeground_) {
+        return;
+    }
+    haveForeground_ = false;
+    foregroundPrefix_.clear();
+    qInfo("Foreground prefix cleared");
+    reapplyAll();
+}
+
+void SchedulingPolicyManager::serverRunning(pid_t pid)
+{
+    int row = listModel_->rowForPid(pid);
+    if (row != -1) {
+        applyToServer(listModel_->server(row));
+    }
+}
+
+void SchedulingPolicyManager::clientsChanged(const WineServerData &server)
+{
+    applyToServer(server);
+}
+
+void SchedulingPolicyManager::serverEnded(const WineServerData &server)
+{
+    applied_.remove(server.pid);
+}
+
+void SchedulingPolicyManager::reapplyAll()
+{
+    // Put back what processes had before, so that settings left over from an
+    // earlier foreground boost or a since removed rule do not stick.
+    for (int row = 0; row < listModel_->rowCount(); row++) {
+        const auto &server = listModel_->server(row);
+        auto applied = applied_.constFind(server.pid);
+        if (applied == applied_.cend()) {
+            continue;
+        }
+        for (auto it = applied->cbegin(); it != applied->cend(); ++it) {
+            if (it.key() == server.pid || server.clientPids.contains(it.key())) {
+                writeSettings(it.key(), it.value());
+            }
+        }
+    }
+
+    applied_.clear();
+    for (int row = 0; row < listModel_->rowCount(); row++) {
+        applyToServer(listModel_->server(row));
+    }
+}
+
+void SchedulingPolicyManager::applyToServer(const WineServerData &server)
+{
+    std::optional<PrefixRule> rule = effectiveRule(server.prefix);
+    if (!rule) {
+        return;
+    }
+
+    // Only the wineserver and the Wine processes found as its clients are
+    // touched. The autogroup nice level is only set for prewarmed servers,
+    // which are the only ones running in a session that winemon started.
+    auto &applied = applied_[server.pid];
+    auto apply = [&](pid_t pid, bool ownSession) {
+        if (applied.contains(pid)) {
+            return;
+        }
+        if (auto original = applyRule(pid, *rule, ownSession)) {
+            applied.insert(pid, *original);
+        }
+    };
+    apply(server.pid, server.prewarmed);
+    for (pid_t clientPid : server.clientPids) {
+        apply(clientPid, false);
+    }
+
+    // Forget clients that have exited so their pids can be reused.
+    applied.removeIf([&server](QHash<pid_t, ProcessSettings>::iterator it) {
+        return it.key() != server.pid && !server.clientPids.contains(it.key());
+    });
+}
+
+auto SchedulingPolicyManager::effectiveRule(const QString &prefix) const -> std::optional<PrefixRule>
+{
+    auto it = rules_.constFind(prefix);
+    if (!haveForeground_) {
+        return it != rules_.cend() ? std::optional<PrefixRule> { *it } : std::nullopt;
+    }
+
+    PrefixRule rule = it != rules_.cend() ? *it : PrefixRule {};
+    if (prefix == foregroundPrefix_) {
+        rule.nice = std::min(rule.nice.value_or(0), 0);
+        if (!rule.ioClass || *rule.ioClass == kIoprioClassIdle) {
+            rule.ioClass = kIoprioClassNone;
+        }
+    } else {
+        rule.nice = std::max(rule.nice.value_or(0), kBackgroundNice);
+        rule.ioClass = kIoprioClassBestEffort;
+        rule.ioLevel = kBackgroundIoLevel;
+        rule.autogroupNice = std::max(rule.autogroupNice.value_or(0), kBackgroundNice);
+    }
+    return rule;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <sched.h>
+
+#include <optional>
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QSettings>
+#include <QVariantMap>
+
+class WineServerListModel;
+struct WineServerData;
+
+/**
+ * Scheduling settings applied to the wineserver and client processes of a
+ * prefix. Unset fields leave the corresponding setting of the process alone.
+ */
+struct PrefixRule
+{
+    /**
+     * Reads a rule from a settings map with the keys "nice", "ioClass"
+     * ("realtime", "best-effort" or "idle"), "ioLevel", "cpus" (a CPU list
+     * such as "0-3,6") and "autogroupNice". The autogroup nice level
+     * is shared by a whole session, so it is only applied to prewarmed
+     * servers, which run in a session of their own.
+     */
+    static auto fromVariant(const QT_PREPEND_NAMESPACE(QVariantMap) & map) -> PrefixRule;
+    [[nodiscard]] auto toVariant() const -> QT_PREPEND_NAMESPACE(QVariantMap);
+
+    std::optional<int> nice;
+    std::optional<int> ioClass;
+    int ioLevel { 4 };
+    QT_PREPEND_NAMESPACE(QList)<int> cpus;
+    std::optional<int> autogroupNice;
+};
+
+/**
+ * Applies per-prefix scheduling rules (nice level, I/O priority, CPU
+ * affinity and autogroup nice level) to wineservers as they start and to
+ * their client processes as they attach.
+ *
+ * One prefix can be made the foreground prefix. While one is set, processes
+ * of every other prefix are pushed into the background; since unprivileged
+ * processes cannot raise their own priority, demoting everything else is
+ * what gives the foreground prefix its boost.
+ *
+ * Changes are undone by putting back the settings each thread had before,
+ * and a nice level is only raised if the process's RLIMIT_NICE allows
+ * lowering it again. The default RLIMIT_NICE of 0 never does, so unless it
+ * is raised, rules and background prefixes only change I/O priority, CPU
+ * affinity and the autogroup nice level.
+ */
+class SchedulingPolicyManager : public QT_PREPEND_NAMESPACE(QObject)
+{
+    Q_OBJECT
+
+public:
+    explicit SchedulingPolicyManager(WineServerListModel *listModel, QObject *parent = nullptr);
+
+    SchedulingPolicyManager(SchedulingPolicyManager &) = delete;
+    SchedulingPolicyManager(SchedulingPolicyManager &&) = delete;
+    auto operator=(SchedulingPolicyManager &) -> SchedulingPolicyManager = delete;
+    auto operator=(SchedulingPolicyManager &&) -> SchedulingPolicyManager = delete;
+
+    /**
+     * Returns the configured rules, keyed by prefix.
+     */
+    [[nodiscard]] auto rules() const -> QT_PREPEND_NAMESPACE(QVariantMap);
+
+    /**
+     * Sets the rule for prefix and reapplies it to running processes. An
+     * empty rule removes it.
+     */
+    void setRule(const QString &prefix, const QT_PREPEND_NAMESPACE(QVariantMap) & rule);
+
+    /**
+     * Returns the number of processes adjusted, the lowest nice level that
+     * can be restored ("niceLimit") and whether that includes the default
+     * of 0 ("niceRestorable"), and how many times a nice level was left
+     * alone because it could not be restored ("niceSkipped").
+     */
+    [[nodiscard]] auto statistics() const -> QT_PREPEND_NAMESPACE(QVariantMap);
+
+    [[nodiscard]] auto hasForegroundPrefix() const -> bool;
+    [[nodiscard]] auto foregroundPrefix() const -> QString;
+    Q_SLOT void setForegroundPrefix(const QString &prefix);
+    Q_SLOT void clearForegroundPrefix();
+
+    /**
+     * Applies the rule of the prefix of a newly started server.
+     */
+    Q_SLOT void serverRunning(pid_t pid);
+
+private:
+    // Scheduling settings of a thread, as the raw values the kernel uses.
+    // Unset fields are not read or written.
+    struct ThreadSettings
+    {
+        std::optional<int> nice;
+        std::optional<int> ioprio;
+        std::optional<cpu_set_t> cpus;
+    };
+
+    // The settings of each thread of a process, keyed by tid, and of the
+    // autogroup it is in.
+    struct ProcessSettings
+    {
+        QT_PREPEND_NAMESPACE(QHash)<pid_t, ThreadSettings> threads;
+        std::optional<int> autogroupNice;
+    };
+
+    void clientsChanged(const WineServerData &server);
+    void serverEnded(const WineServerData &server);
+    void reapplyAll();
+    void applyToServer(const WineServerData &server);
+    [[nodiscard]] auto effectiveRule(const QString &prefix) const -> std::optional<PrefixRule>;
+    void saveRules();
+
+    /**
+     * Applies rule to every thread of process pid and returns the settings
+     * it replaced, or nothing if the process could not be read. ownSession
+     * allows changing the autogroup nice level, which affects the whole
+     * session.
+     */
+    auto applyRule(pid_t pid, const PrefixRule &rule, bool ownSession) -> std::optional<ProcessSettings>;
+
+    /**
+     * Returns the current values, for each thread, of the fields that are
+     * set in fields, and the autogroup nice level if autogroupNice is set.
+     */
+    static auto readSettings(pid_t pid, const ThreadSettings &fields, bool autogroupNice)
+            -> std::optional<ProcessSettings>;
+    static void writeSettings(pid_t pid, const ProcessSettings &settings);
+
+    QT_PREPEND_NAMESPACE(QSettings) settings_;
+    QT_PREPEND_NAMESPACE(QHash)<QString, PrefixRule> rules_;
+    bool haveForeground_ {};
+    QT_PREPEND_NAMESPACE(QString) foregroundPrefix_;
+
+    // Processes that have been adjusted, keyed by server pid and then by
+    // process pid, with the settings they had before. Rules are only applied
+    // once to each process, and the old settings are put back before a
+    // different rule is applied.
+    QT_PREPEND_NAMESPACE(QHash)<pid_t, QHash<pid_t, ProcessSettings>> applied_;
+    qint64 niceSkipped_ {};
+
+    QT_PREPEND_NAMESPACE(QPointer)<WineServerListModel> listModel_;
+};
@@ -0,0 +1,418 @@
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+
+#include "sessionhistory.h"
+#include "wineserverlist.h"
+
+QT_USE_NAMESPACE
+
+constexpr quint32 kLogMagic = 0x48534d57; // "WMSH"
+constexpr quint32 kLogVersion = 1;
+constexpr qint64 kGrowRecords = 4096;
+constexpr qint64 kRetentionMs = 400LL * 24 * 60 * 60 * 1000;
+constexpr qint64 kCompactionIntervalMs = 24LL * 60 * 60 * 1000;
+
+namespace {
+
+// Holds an exclusive flock on the history directory, which every process
+// writing to the history takes before touching its files.
+class DirectoryLock
+{
+public:
+    explicit DirectoryLock(int fd) : fd_ { fd }
+    {
+        while (fd_ != -1 && flock(fd_, LOCK_EX) == -1 && errno == EINTR) {
+        }
+    }
+    ~DirectoryLock()
+    {
+        if (fd_ != -1) {
+            flock(fd_, LOCK_UN);
+        }
+    }
+
+    DirectoryLock(DirectoryLock &) = delete;
+    DirectoryLock(DirectoryLock &&) = delete;
+    auto operator=(DirectoryLock &) -> DirectoryLock = delete;
+    auto operator=(DirectoryLock &&) -> DirectoryLock = delete;
+
+private:
+    int fd_;
+};
+
+}
+
+SessionHistory::SessionHistory(const QString &directory, QObject *parent) : QObject(parent), directory_ { directory }
+{
+    QDir {}.mkpath(directory_);
+    logFile_.setFileName(QDir { directory_ }.absoluteFilePath("sessions.log"));
+    stringsFile_.setFileName(QDir { directory_ }.absoluteFilePath("strings.dat"));
+
+    // Another instance, in another session for example, may share the
+    // directory, so the files are only opened, appended to and compacted
+    // while holding its lock.
+    lockFd_ = open(QFile::encodeName(directory_).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (lockFd_ == -1) {
+        qWarning("Unable to lock session history directory %s (errno=%d)", qPrintable(directory_), errno);
+    }
+    {
+        DirectoryLock directoryLock { lockFd_ };
+        openLog();
+        openStrings();
+    }
+
+    writer_.moveToThread(&writerThread_);
+    writerThread_.setObjectName("SessionHistory");
+    writerThread_.start(QThread::LowPriority);
+    QMetaObject::invokeMethod(&writer_, [this] {
+        DirectoryLock directoryLock { lockFd_ };
+        refresh();
+        compactLog();
+    });
+}
+
+SessionHistory::~SessionHistory()
+{
+    // Quit from the writer thread so that queued records are written first.
+    QMetaObject::invokeMethod(&writer_, [this] { writerThread_.quit(); });
+    writerThread_.wait();
+
+    if (map_ != nullptr) {
+        logFile_.unmap(map_);
+    }
+    if (lockFd_ != -1) {
+        close(lockFd_);
+    }
+}
+
+void SessionHistory::openLog()
+{
+    if (!logFile_.open(QIODevice::ReadWrite)) {
+        qWarning("Unable to open session history at %s", qPrintable(logFile_.fileName()));
+        return;
+    }
+
+    qint64 fileSize = logFile_.size();
+    bool valid = fileSize >= static_cast<qint64>(sizeof(LogHeader));
+    if (valid) {
+        LogHeader fileHeader = {};
+        logFile_.read(reinterpret_cast<char *>(&fileHeader), sizeof(fileHeader)); // NOLINT
+        valid = fileHeader.magic == kLogMagic && fileHeader.version == kLogVersion
+                && fileHeader.recordSize == sizeof(SessionRecord);
+        if (!valid) {
+            qWarning("Session history at %s is invalid; starting a new one", qPrintable(logFile_.fileName()));
+        }
+    }
+
+    if (!valid) {
+        LogHeader fileHeader = {};
+        fileHeader.magic = kLogMagic;
+        fileHeader.version = kLogVersion;
+        fileHeader.recordSize = sizeof(SessionRecord);
+        fileSize = static_cast<qint64>(sizeof(LogHeader)) + kGrowRecords * static_cast<qint64>(sizeof(SessionRecord));
+        logFile_.resize(0);
+        logFile_.seek(0);
+        logFile_.write(reinterpret_cast<const char *>(&fileHeader), sizeof(fileHeader)); // NOLINT
+        logFile_.resize(fileSize);
+    }
+
+    if (mapLog(fileSize)) {
+        count_.store(std::clamp(header()->count, qint64 { 0 }, capacity_));
+    }
+}
+
+void SessionHistory::openStrings()
+{
+    if (!stringsFile_.open(QIODevice::ReadWrite)) {
+        qWarning("Unable to open session history strings at %s", qPrintable(stringsFile_.fileName()));
+        return;
+    }
+
+    readStrings();
+}
+
+void SessionHistory::readStrings()
+{
+    // Picks up strings appended since the last call, by this process or by
+    // another one sharing the directory.
+    stringsFile_.seek(stringsReadPos_);
+    QDataStream stream { &stringsFile_ };
+    stream.setVersion(QDataStream::Qt_6_0);
+    while (!stream.atEnd()) {
+        QString value;
+        stream >> value;
+        if (stream.status() != QDataStream::Ok) {
+            break;
+        }
+        stringIds_.insert(value, static_cast<quint32>(strings_.size()));
+        strings_.append(value);
+        stringsReadPos_ = stringsFile_.pos();
+    }
+    stringsFile_.seek(stringsFile_.size());
+}
+
+void SessionHistory::refresh()
+{
+    // Another process may have appended records, grown the log, or compacted
+    // it into a new file since we last looked.
+    struct stat pathStat = {};
+    struct stat openStat = {};
+    if (stat(QFile::encodeName(logFile_.fileName()).constData(), &pathStat) == -1) {
+        return;
+    }
+    bool replaced = !logFile_.isOpen() || fstat(logFile_.handle(), &openStat) == -1
+            || pathStat.st_ino != openStat.st_ino || pathStat.st_dev != openStat.st_dev;
+    qint64 capacity = (static_cast<qint64>(pathStat.st_size) - static_cast<qint64>(sizeof(LogHeader)))
+            / static_cast<qint64>(sizeof(SessionRecord));
+    if (replaced || map_ == nullptr || capacity != capacity_) {
+        QWriteLocker locker { &lock_ };
+        if (map_ != nullptr) {
+            logFile_.unmap(map_);
+            map_ = nullptr;
+        }
+        if (replaced) {
+            logFile_.close();
+            if (!logFile_.open(QIODevice::ReadWrite)) {
+                qWarning("Unable to reopen session history at %s", qPrintable(logFile_.fileName()));
+                return;
+            }
+        }
+        if (!mapLog(logFile_.size())) {
+            return;
+        }
+    }
+    count_.store(std::clamp(header()->count, qint64 { 0 }, capacity_), std::memory_order_release);
+
+    if (stringsFile_.isOpen() && stringsFile_.size() > stringsReadPos_) {
+        QWriteLocker locker { &lock_ };
+        readStrings();
+    }
+}
+
+auto SessionHistory::mapLog(qint64 fileSize) -> bool
+{
+    map_ = logFile_.map(0, fileSize);
+    if (map_ == nullptr) {
+        qWarning("Unable to map session history (size=%lld)", fileSize);
+        capacity_ = 0;
+        return false;
+    }
+    capacity_ = (fileSize - static_cast<qint64>(sizeof(LogHeader))) / static_cast<qint64>(sizeof(SessionRecord));
+    return true;
+}
+
+auto SessionHistory::header() const -> LogHeader *
+{
+    return reinterpret_cast<LogHeader *>(map_); // NOLINT
+}
+
+auto SessionHistory::records() const -> const SessionRecord *
+{
+    return reinterpret_cast<const SessionRecord *>(map_ + sizeof(LogHeader)); // NOLINT
+}
+
+auto SessionHistory::lowerBound(qint64 stopMs) const -> qint64
+{
+    const auto *begin = records();
+    const auto *end = begin + count_.load(std::memory_order_acquire); // NOLINT
+    return std::lower_bound(begin, end, stopMs, [](const SessionRecord &record, qint64 value) {
+        return record.stopMs < value;
+    }) - begin;
+}
+
+void SessionHistory::append(SessionRecord record, const QString &prefix, const QString &version, const QString &exe)
+{
+    QMetaObject::invokeMethod(&writer_, [this, record, prefix, version, exe] {
+        writeRecord(record, prefix, version, exe);
+    });
+}
+
+void SessionHistory::serverEnded(const WineServerData &server)
+{
+    // A prewarmed server that nothing used says nothing about when the prefix
+    // is used, and one that was used only counts from its first client.
+    // Sandboxed servers are left out, since their prefix and binary are paths
+    // inside the sandbox that prewarming would use on the host.
+    if (server.sandboxed || (server.prewarmed && !server.prewarmUsed)) {
+        return;
+    }
+
+    SessionRecord record = {};
+    record.stopMs = QDateTime::currentMSecsSinceEpoch();
+    record.startMs = server.prewarmed ? server.prewarmUsedMs : server.startedMs;
+    if (record.startMs <= 0) {
+        record.startMs = record.stopMs;
+    }
+    record.peakRss = server.peakRss;
+    record.peakClients = static_cast<quint32>(server.peakClients);
+    record.pid = static_cast<quint32>(server.pid);
+    append(record, server.prefix, server.package, server.exe);
+}
+
+void SessionHistory::writeRecord(SessionRecord record, const QString &prefix, const QString &version, const QString &exe)
+{
+    DirectoryLock directoryLock { lockFd_ };
+    refresh();
+    if (map_ == nullptr) {
+        return;
+    }
+
+    record.prefixId = intern(prefix);
+    record.versionId = intern(version);
+    record.exeId = intern(exe);
+
+    qint64 count = count_.load(std::memory_order_relaxed);
+    if (count > 0) {
+        // Keep the log ordered by stop time even if the clock goes backwards.
+        record.stopMs = std::max(record.stopMs, records()[count - 1].stopMs); // NOLINT
+        record.startMs = std::min(record.startMs, record.stopMs);
+    }
+
+    if (count == capacity_) {
+        QWriteLocker locker { &lock_ };
+        qint64 fileSize = logFile_.size() + kGrowRecords * static_cast<qint64>(sizeof(SessionRecord));
+        logFile_.unmap(map_);
+        if (!logFile_.resize(fileSize) || !mapLog(fileSize)) {
+            qWarning("Unable to grow session history to %lld bytes", fileSize);
+            map_ = nullptr;
+            return;
+        }
+    }
+
+    // Readers only look at [0, count), so the record can be written without
+    // taking the write lock as long as count is published afterwards.
+    memcpy(map_ + sizeof(LogHeader) + count * sizeof(SessionRecord), &record, sizeof(record)); // NOLINT
+    count_.store(count + 1, std::memory_order_release);
+    header()->count = count + 1;
+
+    if (record.stopMs - lastCompactionMs_ > kCompactionIntervalMs) {
+        compactLog();
+    }
+}
+
+auto SessionHistory::intern(const QString &value) -> quint32
+{
+    auto it = stringIds_.constFind(value);
+    if (it != stringIds_.constEnd()) {
+        return it.value();
+    }
+
+    QWriteLocker locker { &lock_ };
+    auto id = static_cast<quint32>(strings_.size());
+    strings_.append(value);
+    stringIds_.insert(value, id);
+
+    QDataStream stream { &stringsFile_ };
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << value;
+    stringsFile_.flush();
+    stringsReadPos_ = stringsFile_.pos();
+    return id;
+}
+
+void SessionHistory::compactLog()
+{
+    lastCompactionMs_ = QDateTime::currentMSecsSinceEpoch();
+    if (map_ == nullptr) {
+        return;
+    }
+
+    qint64 first = lowerBound(lastCompactionMs_ - kRetentionMs);
+    if (first == 0) {
+        return;
+    }
+
+    // Write the records we keep to a new file, then swap it in.
+    qint64 count = count_.load(std::memory_order_relaxed);
+    qint64 kept = count - first;
+    qint64 fileSize = static_cast<qint64>(sizeof(LogHeader))
+            + (kept + kGrowRecords) * static_cast<qint64>(sizeof(SessionRecord));
+    QFile newFile { logFile_.fileName() + ".new" };
+    if (!newFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning("Unable to compact session history into %s", qPrintable(newFile.fileName()));
+        return;
+    }
+    LogHeader newHeader = *header();
+    newHeader.count = kept;
+    newFile.write(reinterpret_cast<const char *>(&newHeader), sizeof(newHeader)); // NOLINT
+    newFile.write(reinterpret_cast<const char *>(records() + first), kept * sizeof(SessionRecord)); // NOLINT
+    newFile.resize(fileSize);
+    newFile.close();
+
+    QWriteLocker locker { &lock_ };
+    logFile_.unmap(map_);
+    logFile_.close();
+    map_ = nullptr;
+    if (std::rename(QFile::encodeName(newFile.fileName()).constData(), QFile::encodeName(logFile_.fileName()).constData())
+            != 0) {
+        qWarning("Unable to replace session history (errno=%d)", errno);
+    }
+    if (logFile_.open(QIODevice::ReadWrite) && mapLog(logFile_.size())) {
+        count_.store(std::clamp(header()->count, qint64 { 0 }, capacity_), std::memory_order_release);
+    }
+    qDebug("Compacted session history, dropped %lld records", first);
+}
+
+void SessionHistory::forEachSession(qint64 fromMs,
+        qint64 toMs,
+        const std::function<void(const SessionRecord &)> &visitor) const
+{
+    QReadLocker locker { &lock_ };
+    if (map_ == nullptr) {
+        return;
+    }
+
+    // Sessions are sorted by stop time, so everything that stopped before the
+    // range starts can be skipped with a binary search.
+    qint64 count = count_.load(std::memory_order_acquire);
+    const auto *log = records();
+    for (qint64 i = lowerBound(fromMs); i < count; i++) {
+        const auto &record = log[i]; // NOLINT
+        if (record.startMs <= toMs) {
+            visitor(record);
+        }
+    }
+}
+
+auto SessionHistory::usageByPrefix(qint64 fromMs, qint64 toMs) const -> QList<PrefixUsage>
+{
+    QHash<quint32, PrefixUsage> usage;
+    forEachSession(fromMs, toMs, [&](const SessionRecord &record) {
+        auto &prefixUsage = usage[record.prefixId];
+        prefixUsage.seconds += (std::min(record.stopMs, toMs) - std::max(record.startMs, fromMs)) / 1000;
+        prefixUsage.sessions++;
+    });
+
+    QList<PrefixUsage> result;
+    result.reserve(usage.size());
+    for (auto it = usage.begin(); it != usage.end(); ++it) {
+        it->prefix = string(it.key());
+        result.append(it.value());
+    }
+    std::sort(result.begin(), result.end(), [](const PrefixUsage &a, const PrefixUsage &b) {
+        return a.seconds > b.seconds;
+    });
+    return result;
+}
+
+auto SessionHistory::string(quint32 id) const -> QString
+{
+    QReadLocker locker { &lock_ };
+    return strings_.value(static_cast<qsizetype>(id));
+}
+
+auto SessionHistory::size() const -> qint64
+{
+    return count_.load(std::memory_order_acquire);
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QReadWriteLock>
+#include <QStringList>
+#include <QThread>
+
+struct WineServerData;
+
+/**
+ * A single finished server lifetime, as stored in the session history log.
+ * Strings are stored as ids into the history's string table.
+ */
+struct SessionRecord
+{
+    qint64 startMs;
+    qint64 stopMs;
+    qint64 peakRss;
+    quint32 prefixId;
+    quint32 versionId;
+    quint32 exeId;
+    quint32 peakClients;
+    quint32 pid;
+    quint32 reserved;
+};
+
+static_assert(sizeof(SessionRecord) == 48, "SessionRecord is part of the on-disk format");
+
+struct PrefixUsage
+{
+    QString prefix;
+    qint64 seconds {};
+    int sessions {};
+};
+
+/**
+ * Append-only log of finished wineserver lifetimes.
+ *
+ * Records are fixed-size and kept in a memory-mapped file ordered by stop
+ * time, so a range query binary searches to the start of the range and only
+ * touches the records inside it. Appends and compaction run on a background
+ * thread; queries may be made from any thread. Processes sharing the
+ * directory take turns through an flock on it, and each picks up the
+ * other's records before appending.
+ */
+class SessionHistory : public QT_PREPEND_NAMESPACE(QObject)
+{
+    Q_OBJECT
+
+public:
+    explicit SessionHistory(const QT_PREPEND_NAMESPACE(QString) & directory, QObject *parent = nullptr);
+    ~SessionHistory() override;
+
+    SessionHistory(SessionHistory &) = delete;
+    SessionHistory(SessionHistory &&) = delete;
+    auto operator=(SessionHistory &) -> SessionHistory = delete;
+    auto operator=(SessionHistory &&) -> SessionHistory = delete;
+
+    /**
+     * Queues a record to be appended to the log. The string ids of record
+     * are filled in from prefix, version and exe.
+     */
+    void append(SessionRecord record, const QString &prefix, const QString &version, const QString &exe);
+
+    /**
+     * Records a server that has just stopped.
+     */
+    void serverEnded(const WineServerData &server);
+
+    /**
+     * Calls visitor for every session that overlaps [fromMs, toMs]. The
+     * history is read-locked during the call; the visitor may call string().
+     */
+    void forEachSession(qint64 fromMs, qint64 toMs, const std::function<void(const SessionRecord &)> &visitor) const;
+
+    /**
+     * Returns the time spent in each prefix between fromMs and toMs, most
+     * used first.
+     */
+    [[nodiscard]] auto usageByPrefix(qint64 fromMs, qint64 toMs) const -> QList<PrefixUsage>;
+
+    [[nodiscard]] auto string(quint32 id) const -> QString;
+    [[nodiscard]] auto size() const -> qint64;
+
+private:
+    struct LogHeader
+    {
+        quint32 magic;
+        quint32 version;
+        quint32 recordSize;
+        quint32 reserved;
+        qint64 count;
+        qint64 padding[5]; // NOLINT(cppcoreguidelines-avoid-c-arrays)
+    };
+
+    void openLog();
+    void openStrings();
+    void readStrings();
+    auto mapLog(qint64 fileSize) -> bool;
+    [[nodiscard]] auto header() const -> LogHeader *;
+    [[nodiscard]] auto records() const -> const SessionRecord *;
+    [[nodiscard]] auto lowerBound(qint64 stopMs) const -> qint64;
+
+    // These only run on the writer thread; all but writeRecord() with the
+    // directory locked.
+    void writeRecord(SessionRecord record, const QString &prefix, const QString &version, const QString &exe);
+    void refresh();
+    auto intern(const QString &value) -> quint32;
+    void compactLog();
+
+    QT_PREPEND_NAMESPACE(QString) directory_;
+    QT_PREPEND_NAMESPACE(QFile) logFile_;
+    QT_PREPEND_NAMESPACE(QFile) stringsFile_;
+    qint64 stringsReadPos_ {};
+    int lockFd_ = -1;
+    uchar *map_ = nullptr;
+    qint64 capacity_ {};
+    std::atomic<qint64> count_ {};
+    qint64 lastCompactionMs_ {};
+
+    QT_PREPEND_NAMESPACE(QStringList) strings_;
+    QT_PREPEND_NAMESPACE(QHash)<QString, quint32> stringIds_;
+    mutable QT_PREPEND_NAMESPACE(QReadWriteLock) lock_ { QReadWriteLock::Recursive };
+
+    QT_PREPEND_NAMESPACE(QThread) writerThread_;
+    QT_PREPEND_NAMESPACE(QObject) writer_;
+};
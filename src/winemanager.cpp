@@ -1,8 +1,23 @@
+#include <unistd.h>
+
+#include <QActionGroup>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
 #include <QWidget>
 
+#include "cgroupmanager.h"
+#include "hookrunner.h"
 #include "maindialog.h"
+#include "pagecachewarmer.h"
+#include "prewarmmanager.h"
+#include "schedulingpolicy.h"
+#include "sessionhistory.h"
 #include "winemanager.h"
 #include "winemonitor.h"
+#include "wineprocess.h"
 #include "wineserverlist.h"
 
 QT_USE_NAMESPACE
@@ -10,6 +25,10 @@ QT_USE_NAMESPACE
 constexpr QStringView kShouldNotifyOnStartKey = u"shouldNotifyOnStart";
 constexpr QStringView kShouldNotifyOnStopKey = u"shouldNotifyOnStop";
 constexpr QStringView kShouldAlwaysShowKey = u"shouldAlwaysShow";
+constexpr QStringView kCgroupRootKey = u"cgroupRoot";
+
+// How long the dialog is kept around after it is hidden.
+constexpr int kDialogTeardownMs = 60 * 1000;
 
 WineManager::WineManager(QObject *parent)
     : QObject(parent)
@@ -18,40 +37,98 @@ WineManager::WineManager(QObject *parent)
     , shouldAlwaysShow_ { settings_.value(kShouldAlwaysShowKey, false).toBool() }
     , wineMonitor_ { WineMonitor::create(this) }
     , listModel_ { new WineServerListModel(this) }
-    , mainDialog_ { new MainDialog(this) }
+    , history_ { new SessionHistory(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation), this) }
+    , prewarmManager_ { new PrewarmManager(history_, listModel_, this) }
+    , pageCacheWarmer_ { new PageCacheWarmer(
+              QDir { QStandardPaths::writableLocation(QStandardPaths::CacheLocation) }.absoluteFilePath("pagecache"),
+              listModel_,
+              this) }
+    , schedulingPolicy_ { new SchedulingPolicyManager(listModel_, this) }
+    , cgroupManager_ { new CgroupManager(settings_.value(kCgroupRootKey).toString(), listModel_, this) }
+    , hookRunner_ { new HookRunner(listModel_, this) }
 {
-    trayIcon_.setIcon(QIcon::fromTheme("wine"));
+    listModel_->setCgroupManager(cgroupManager_);
+    // The model is connected first so that its rows exist by the time our
+    // own slots run.
+    QObject::connect(wineMonitor_, &WineMonitor::serverRunning, listModel_, &WineServerListModel::serverRunning);
+    QObject::connect(wineMonitor_, &WineMonitor::serverStopped, listModel_, &WineServerListModel::serverStopped);
+    QObject::connect(wineMonitor_, &WineMonitor::serverRunning, cgroupManager_, &CgroupManager::serverRunning);
     QObject::connect(wineMonitor_, &WineMonitor::initialized, this, &WineManager::monitorInitialized);
     QObject::connect(wineMonitor_, &WineMonitor::serverRunning, this, &WineManager::serverRunning);
     QObject::connect(wineMonitor_, &WineMonitor::serverStopped, this, &WineManager::serverStopped);
-    QObject::connect(wineMonitor_, &WineMonitor::serverRunning, listModel_, &WineServerListModel::serverRunning);
-    QObject::connect(wineMonitor_, &WineMonitor::serverStopped, listModel_, &WineServerListModel::serverStopped);
-    QObject::connect(&trayIcon_, &QSystemTrayIcon::activated, this, &WineManager::invoke);
+    QObject::connect(listModel_, &WineServerListModel::serverEnded, history_, &SessionHistory::serverEnded);
+    dialogTeardownTimer_.setSingleShot(true);
+    dialogTeardownTimer_.setInterval(kDialogTeardownMs);
+    QObject::connect(&dialogTeardownTimer_, &QTimer::timeout, this, &WineManager::destroyDialog);
+    if (shouldAlwaysShow_) {
+        trayIcon()->show();
+    }
+    QTimer::singleShot(0, this, &WineManager::startupFinished);
     wineMonitor_->start();
 }
 
 WineManager::~WineManager() = default;
 
+auto WineManager::trayIcon() -> QSystemTrayIcon *
+{
+    if (!trayIcon_) {
+        trayMenu_.reset(new QMenu);
+        trayIcon_.reset(new QSystemTrayIcon(QIcon::fromTheme("wine")));
+        trayIcon_->setContextMenu(trayMenu_.get());
+        QObject::connect(trayIcon_.get(), &QSystemTrayIcon::activated, this, &WineManager::trayActivated);
+        QObject::connect(trayMenu_.get(), &QMenu::aboutToShow, this, &WineManager::updateTrayMenu);
+        updateTrayMenu();
+    }
+    return trayIcon_.get();
+}
+
+void WineManager::startupFinished()
+{
+    qint64 startedMs = processStartTimeMs(getpid());
+    if (startedMs > 0) {
+        startupMs_ = QDateTime::currentMSecsSinceEpoch() - startedMs;
+        qDebug("Started in %lld ms", startupMs_);
+    }
+}
+
 void WineManager::monitorInitialized()
 {
     monitorInitialized_ = true;
+    if (pageCacheWarmer_->enabled()) {
+        for (const auto &prefix : prewarmManager_->candidatePrefixes()) {
+            pageCacheWarmer_->warmPrefix(prefix);
+        }
+    }
+    prewarmManager_->prewarmNow();
 }
 
 void WineManager::serverRunning(pid_t pid)
 {
-    trayIcon_.setVisible(true);
+    bool prewarmed = prewarmManager_->claim(pid);
+
+    // Rules and hooks are applied once the server is known to be prewarmed
+    // or not. Rules apply to servers found at startup too, but those did not
+    // just start, so they run no start hooks.
+    schedulingPolicy_->serverRunning(pid);
+    trayIcon()->setVisible(true);
     if (!monitorInitialized_) {
         return;
     }
-    if (shouldNotifyOnStart_) {
-        trayIcon_.showMessage("Wine Server Started", QString("Wine server started with PID %1").arg(pid));
+    hookRunner_->serverRunning(pid);
+    if (int row = listModel_->rowForPid(pid); !prewarmed && row != -1) {
+        prewarmManager_->recordColdStart(pid);
+        pageCacheWarmer_->recordLaunch(listModel_->server(row));
+    }
+    if (shouldNotifyOnStart_ && !prewarmed) {
+        trayIcon()->showMessage("Wine Server Started", QString("Wine server started with PID %1").arg(pid));
     }
 }
 
 void WineManager::serverStopped(pid_t pid, bool lastServer)
 {
-    if (shouldNotifyOnStop_) {
-        trayIcon_.showMessage("Wine Server Stopped", QString("Wine server (PID %1) has stopped").arg(pid));
+    bool unusedPrewarm = prewarmManager_->release(pid);
+    if (shouldNotifyOnStop_ && !unusedPrewarm) {
+        trayIcon()->showMessage("Wine Server Stopped", QString("Wine server (PID %1) has stopped").arg(pid));
     }
     if (!shouldAlwaysShow_) {
         // Even with quitOnLastWindowClosed set to false, at least with the
@@ -59,15 +136,182 @@ void WineManager::serverStopped(pid_t pid, bool lastServer)
         // quit the application, but we want to continue running.
         QWidget widget;
         widget.setVisible(true);
-        trayIcon_.setVisible(!lastServer);
+        trayIcon()->setVisible(!lastServer);
+    }
+}
+
+void WineManager::trayActivated(QSystemTrayIcon::ActivationReason reason)
+{
+    if (reason != QSystemTrayIcon::Context) {
+        invoke();
     }
 }
 
+void WineManager::updateTrayMenu()
+{
+    trayMenu_->clear();
+    trayMenu_->addAction("Show Winemon", this, &WineManager::invoke);
+
+    QMenu *foregroundMenu = trayMenu_->addMenu("Foreground Prefix");
+    auto *foregroundGroup = new QActionGroup(foregroundMenu);
+    QAction *noneAction = foregroundMenu->addAction("None");
+    noneAction->setCheckable(true);
+    noneAction->setChecked(!schedulingPolicy_->hasForegroundPrefix());
+    foregroundGroup->addAction(noneAction);
+    QObject::connect(
+            noneAction, &QAction::triggered, schedulingPolicy_, &SchedulingPolicyManager::clearForegroundPrefix);
+
+    QStringList prefixes;
+    for (int row = 0; row < listModel_->rowCount(); row++) {
+        const auto &prefix = listModel_->server(row).prefix;
+        if (!prefixes.contains(prefix)) {
+            prefixes.append(prefix);
+        }
+    }
+    if (schedulingPolicy_->hasForegroundPrefix() && !prefixes.contains(schedulingPolicy_->foregroundPrefix())) {
+        prefixes.append(schedulingPolicy_->foregroundPrefix());
+    }
+    if (!prefixes.isEmpty()) {
+        foregroundMenu->addSeparator();
+    }
+    for (const auto &prefix : prefixes) {
+        QAction *action = foregroundMenu->addAction(prefix.isEmpty() ? QString { "(default prefix)" } : prefix);
+        action->setCheckable(true);
+        action->setChecked(
+                schedulingPolicy_->hasForegroundPrefix() && schedulingPolicy_->foregroundPrefix() == prefix);
+        foregroundGroup->addAction(action);
+        QObject::connect(action, &QAction::triggered, schedulingPolicy_, [this, prefix] {
+            schedulingPolicy_->setForegroundPrefix(prefix);
+        });
+    }
+
+    trayMenu_->addSeparator();
+    trayMenu_->addAction("Quit", qApp, &QCoreApplication::quit);
+}
+
 auto WineManager::listModel() const -> WineServerListModel *
 {
     return listModel_;
 }
 
+auto WineManager::history() const -> SessionHistory *
+{
+    return history_;
+}
+
+auto WineManager::prewarmManager() const -> PrewarmManager *
+{
+    return prewarmManager_;
+}
+
+auto WineManager::prewarmPrefix(const QString &prefix) -> bool
+{
+    return prewarmManager_->prewarmPrefix(prefix);
+}
+
+auto WineManager::prewarmStatistics() const -> QVariantMap
+{
+    return prewarmManager_->statistics();
+}
+
+auto WineManager::pageCacheWarmer() const -> PageCacheWarmer *
+{
+    return pageCacheWarmer_;
+}
+
+auto WineManager::warmPageCache(const QString &prefix) -> bool
+{
+    return pageCacheWarmer_->warmPrefix(prefix);
+}
+
+auto WineManager::pageCacheStatistics() const -> QVariantMap
+{
+    return pageCacheWarmer_->statistics();
+}
+
+auto WineManager::schedulingPolicy() const -> SchedulingPolicyManager *
+{
+    return schedulingPolicy_;
+}
+
+auto WineManager::cgroupManager() const -> CgroupManager *
+{
+    return cgroupManager_;
+}
+
+auto WineManager::hookRunner() const -> HookRunner *
+{
+    return hookRunner_;
+}
+
+auto WineManager::cgroupStatistics() const -> QVariantMap
+{
+    return cgroupManager_->statistics();
+}
+
+auto WineManager::prefixLimits() const -> QVariantMap
+{
+    return cgroupManager_->limits();
+}
+
+void WineManager::setPrefixLimits(const QString &prefix, const QVariantMap &limits)
+{
+    cgroupManager_->setLimits(prefix, limits);
+}
+
+auto WineManager::hooks() const -> QVariantList
+{
+    return hookRunner_->hooks();
+}
+
+void WineManager::setHooks(const QVariantList &hooks)
+{
+    hookRunner_->setHooks(hooks);
+}
+
+auto WineManager::hookStatistics() const -> QVariantMap
+{
+    return hookRunner_->statistics();
+}
+
+auto WineManager::prefixRules() const -> QVariantMap
+{
+    return schedulingPolicy_->rules();
+}
+
+void WineManager::setPrefixRule(const QString &prefix, const QVariantMap &rule)
+{
+    schedulingPolicy_->setRule(prefix, rule);
+}
+
+void WineManager::setForegroundPrefix(const QString &prefix)
+{
+    schedulingPolicy_->setForegroundPrefix(prefix);
+}
+
+void WineManager::clearForegroundPrefix()
+{
+    schedulingPolicy_->clearForegroundPrefix();
+}
+
+auto WineManager::schedulingStatistics() const -> QVariantMap
+{
+    return schedulingPolicy_->statistics();
+}
+
+auto WineManager::prefixUsageHours(int days) const -> QVariantMap
+{
+    static constexpr qint64 kDayMs = 24LL * 60 * 60 * 1000;
+    static constexpr double kSecondsPerHour = 3600.0;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QVariantMap result;
+    for (const auto &usage : history_->usageByPrefix(now - days * kDayMs, now)) {
+        result.insert(usage.prefix, static_cast<double>(usage.seconds) / kSecondsPerHour);
+    }
+    return result;
+}
+
 auto WineManager::shouldNotifyOnStart() const -> bool
 {
     return shouldNotifyOnStart_;
@@ -104,18 +348,24 @@ void WineManager::setShouldAlwaysShow(bool value)
     settings_.sync();
 
     if (value) {
-        if (!trayIcon_.isVisible()) {
-            trayIcon_.show();
+        if (!trayIcon()->isVisible()) {
+            trayIcon()->show();
         }
     } else {
-        if (trayIcon_.isVisible() && listModel_->rowCount() == 0) {
-            trayIcon_.hide();
+        if (trayIcon_ && trayIcon_->isVisible() && listModel_->rowCount() == 0) {
+            trayIcon_->hide();
         }
     }
 }
 
 void WineManager::invoke()
 {
+    dialogTeardownTimer_.stop();
+    if (!mainDialog_) {
+        mainDialog_.reset(new MainDialog(this));
+        QObject::connect(mainDialog_.get(), &MainDialog::hidden, this, &WineManager::dialogHidden);
+    }
+
     if (mainDialog_->isVisible()) {
         mainDialog_->activateWindow();
         return;
@@ -123,3 +373,47 @@ void WineManager::invoke()
 
     mainDialog_->show();
 }
+
+void WineManager::dialogHidden()
+{
+    dialogTeardownTimer_.start();
+}
+
+void WineManager::destroyDialog()
+{
+    if (mainDialog_ && !mainDialog_->isVisible()) {
+        mainDialog_.reset();
+    }
+}
+
+auto WineManager::footprint() const -> QVariantMap
+{
+    // Context switches are per thread, so they are summed over all threads;
+    // voluntary switches of an idle process are mostly timer and I/O wakeups.
+    qlonglong voluntarySwitches = 0;
+    qlonglong involuntarySwitches = 0;
+    for (const auto &task : QDir { "/proc/self/task" }.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        QFile status { QString { "/proc/self/task/%1/status" }.arg(task) };
+        if (!status.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        for (const auto &line : status.readAll().split('\n')) {
+            if (line.startsWith("voluntary_ctxt_switches:")) {
+                voluntarySwitches += line.sliced(line.indexOf(':') + 1).trimmed().toLongLong();
+            } else if (line.startsWith("nonvoluntary_ctxt_switches:")) {
+                involuntarySwitches += line.sliced(line.indexOf(':') + 1).trimmed().toLongLong();
+            }
+        }
+    }
+
+    qint64 startedMs = processStartTimeMs(getpid());
+    return {
+        { "startupMs", startupMs_ },
+        { "uptimeMs", startedMs > 0 ? QDateTime::currentMSecsSinceEpoch() - startedMs : -1 },
+        { "residentBytes", processResidentBytes(getpid()) },
+        { "voluntaryContextSwitches", voluntarySwitches },
+        { "involuntaryContextSwitches", involuntarySwitches },
+        { "dialogCreated", !mainDialog_.isNull() },
+        { "trayIconCreated", !trayIcon_.isNull() },
+    };
+}
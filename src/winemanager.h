@@ -1,12 +1,23 @@
 #pragma once
 
+#include <QElapsedTimer>
+#include <QMenu>
 #include <QObject>
 #include <QPointer>
 #include <QScopedPointer>
 #include <QSettings>
 #include <QSystemTrayIcon>
+#include <QTimer>
+#include <QVariantList>
+#include <QVariantMap>
 
+class CgroupManager;
+class HookRunner;
 class MainDialog;
+class PageCacheWarmer;
+class PrewarmManager;
+class SchedulingPolicyManager;
+class SessionHistory;
 class WineMonitor;
 class WineServerListModel;
 
@@ -27,6 +38,109 @@ public:
     auto operator=(WineManager &&) -> WineManager = delete;
 
     [[nodiscard]] auto listModel() const -> WineServerListModel *;
+    [[nodiscard]] auto history() const -> SessionHistory *;
+    [[nodiscard]] auto prewarmManager() const -> PrewarmManager *;
+    [[nodiscard]] auto pageCacheWarmer() const -> PageCacheWarmer *;
+    [[nodiscard]] auto schedulingPolicy() const -> SchedulingPolicyManager *;
+    [[nodiscard]] auto cgroupManager() const -> CgroupManager *;
+    [[nodiscard]] auto hookRunner() const -> HookRunner *;
+
+    /**
+     * Returns the hours spent in each prefix over the last days days, keyed
+     * by prefix path.
+     */
+    Q_SLOT QT_PREPEND_NAMESPACE(QVariantMap) prefixUsageHours(int days) const; // NOLINT(modernize-use-trailing-return-type)
+
+    /**
+     * Starts a persistent wineserver for prefix ahead of a launch. Returns
+     * false if no wineserver binary is known for the prefix.
+     */
+    Q_SLOT bool prewarmPrefix(const QString &prefix); // NOLINT(modernize-use-trailing-return-type)
+
+    /**
+     * Returns counts of prewarms and of prewarmed servers that were used,
+     * and the measured start latency they saved; see
+     * PrewarmManager::statistics().
+     */
+    Q_SLOT QT_PREPEND_NAMESPACE(QVariantMap) prewarmStatistics() const; // NOLINT(modernize-use-trailing-return-type)
+
+    /**
+     * Starts reading the files prefix is known to use into the page cache.
+     * Returns false if nothing has been recorded for the prefix yet.
+     */
+    Q_SLOT bool warmPageCache(const QString &prefix); // NOLINT(modernize-use-trailing-return-type)
+
+    /**
+     * Returns the bytes requested, bytes resident afterwards, bytes already
+     * cached, files skipped for lack of budget and time taken by the last
+     * page cache warm of each prefix, and the mean start time of servers in
+     * warmed and cold prefixes.
+     */
+    Q_SLOT QT_PREPEND_NAMESPACE(QVariantMap) pageCacheStatistics() const; // NOLINT(modernize-use-trailing-return-type)
+
+    /**
+     * Returns the scheduling rules, keyed by prefix.
+     */
+    Q_SLOT QT_PREPEND_NAMESPACE(QVariantMap) prefixRules() const; // NOLINT(modernize-use-trailing-return-type)
+
+    /**
+     * Sets the scheduling rule for prefix; see PrefixRule::fromVariant for
+     * the keys. An empty rule removes it.
+     */
+    Q_SLOT void setPrefixRule(const QString &prefix, const QT_PREPEND_NAMESPACE(QVariantMap) & rule);
+
+    /**
+     * Boosts prefix over all other prefixes until cleared.
+     */
+    Q_SLOT void setForegroundPrefix(const QString &prefix);
+    Q_SLOT void clearForegroundPrefix();
+
+    /**
+     * Returns how many processes scheduling rules were applied to, and
+     * whether nice levels can be changed; see
+     * SchedulingPolicyManager::statistics().
+     */
+    Q_SLOT QT_PREPEND_NAMESPACE(QVariantMap) schedulingStatistics() const; // NOLINT(modernize-use-trailing-return-type)
+
+    /**
+     * Returns the CPU, memory and I/O usage of each prefix that has its own
+     * cgroup, keyed by prefix.
+     */
+    Q_SLOT QT_PREPEND_NAMESPACE(QVariantMap) cgroupStatistics() const; // NOLINT(modernize-use-trailing-return-type)
+
+    /**
+     * Returns the cgroup limits, keyed by prefix.
+     */
+    Q_SLOT QT_PREPEND_NAMESPACE(QVariantMap) prefixLimits() const; // NOLINT(modernize-use-trailing-return-type)
+
+    /**
+     * Sets the memory.high ("memoryHigh", in bytes) and cpu.weight
+     * ("cpuWeight") of the cgroup of prefix. Empty limits remove them.
+     */
+    Q_SLOT void setPrefixLimits(const QString &prefix, const QT_PREPEND_NAMESPACE(QVariantMap) & limits);
+
+    /**
+     * Returns the hooks run when servers start or stop; see Hook::fromVariant
+     * for the keys.
+     */
+    Q_SLOT QT_PREPEND_NAMESPACE(QVariantList) hooks() const; // NOLINT(modernize-use-trailing-return-type)
+
+    /**
+     * Replaces the hooks run when servers start or stop.
+     */
+    Q_SLOT void setHooks(const QT_PREPEND_NAMESPACE(QVariantList) & hooks);
+
+    /**
+     * Returns counts of hook runs and of events deduplicated or dropped.
+     */
+    Q_SLOT QT_PREPEND_NAMESPACE(QVariantMap) hookStatistics() const; // NOLINT(modernize-use-trailing-return-type)
+
+    /**
+     * Returns the startup time, resident memory and context switches of
+     * this process, and whether the dialog and tray icon currently exist,
+     * to keep track of what Winemon costs while idle.
+     */
+    Q_SLOT QT_PREPEND_NAMESPACE(QVariantMap) footprint() const; // NOLINT(modernize-use-trailing-return-type)
 
     [[nodiscard]] auto shouldNotifyOnStart() const -> bool;
     Q_SLOT void setShouldNotifyOnStart(bool value);
@@ -43,6 +157,12 @@ private:
     Q_SLOT void monitorInitialized();
     Q_SLOT void serverRunning(pid_t pid);
     Q_SLOT void serverStopped(pid_t pid, bool lastServer);
+    Q_SLOT void trayActivated(QT_PREPEND_NAMESPACE(QSystemTrayIcon)::ActivationReason reason);
+    Q_SLOT void updateTrayMenu();
+    Q_SLOT void dialogHidden();
+    Q_SLOT void destroyDialog();
+    Q_SLOT void startupFinished();
+    auto trayIcon() -> QT_PREPEND_NAMESPACE(QSystemTrayIcon) *;
 
     bool monitorInitialized_ {};
 
@@ -53,6 +173,19 @@ private:
 
     QT_PREPEND_NAMESPACE(QPointer)<WineMonitor> wineMonitor_;
     QT_PREPEND_NAMESPACE(QPointer)<WineServerListModel> listModel_;
+    QT_PREPEND_NAMESPACE(QPointer)<SessionHistory> history_;
+    QT_PREPEND_NAMESPACE(QPointer)<PrewarmManager> prewarmManager_;
+    QT_PREPEND_NAMESPACE(QPointer)<PageCacheWarmer> pageCacheWarmer_;
+    QT_PREPEND_NAMESPACE(QPointer)<SchedulingPolicyManager> schedulingPolicy_;
+    QT_PREPEND_NAMESPACE(QPointer)<CgroupManager> cgroupManager_;
+    QT_PREPEND_NAMESPACE(QPointer)<HookRunner> hookRunner_;
+
+    // The dialog and tray icon are only created when needed, so that an idle
+    // session without Wine does not pay for them.
     QT_PREPEND_NAMESPACE(QScopedPointer)<MainDialog> mainDialog_;
-    QT_PREPEND_NAMESPACE(QSystemTrayIcon) trayIcon_;
+    QT_PREPEND_NAMESPACE(QTimer) dialogTeardownTimer_;
+    QT_PREPEND_NAMESPACE(QScopedPointer)<QMenu> trayMenu_;
+    QT_PREPEND_NAMESPACE(QScopedPointer)<QSystemTrayIcon> trayIcon_;
+
+    qint64 startupMs_ { -1 };
 };
@@ -1,20 +1,42 @@
+#include <fcntl.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <QDateTime>
 #include <QDir>
 #include <QFileSystemWatcher>
+#include <QSaveFile>
+#include <QSocketNotifier>
+#include <QStandardPaths>
 
 #include "winemonitor_linux.h"
+#include "wineprocess.h"
 
 QT_USE_NAMESPACE
 
 constexpr QStringView kWineServerPrefixFormat = u"/tmp/.wine-%1";
 constexpr int kEpollSize = 0x1000;
 
+// A wineserver creates its directory before it takes the lock in it, so
+// directories are only removed once they have been left alone this long.
+constexpr qint64 kStaleGraceMs = 10LL * 60 * 1000;
+constexpr int kCollectIntervalMs = 60 * 60 * 1000;
+
+// A socket that refuses connections while its wineserver holds the lock is
+// probed again this often, up to kMaxReprobes times: the server has bound the
+// socket but not started listening on it yet.
+constexpr int kReprobeDelayMs = 250;
+constexpr int kMaxReprobes = 20;
+
+// Sandboxes are looked for this long after $XDG_RUNTIME_DIR/.flatpak changes,
+// since Flatpak registers an instance there before it sets up the sandbox.
+constexpr int kDiscoverDelayMs = 1000;
+
 namespace {
 
 auto pidfd_open(pid_t pid, unsigned int flags) -> int
@@ -23,7 +45,7 @@ auto pidfd_open(pid_t pid, unsigned int flags) -> int
     return static_cast<int>(syscall(kSyscallPidfdOpen, pid, flags)); // NOLINT(cppcoreguidelines-pro-type-vararg)
 }
 
-auto getWineserverPid(QStringView socketPath) -> pid_t
+auto getWineserverPid(QStringView socketPath, bool &refused) -> pid_t
 {
     socklen_t len {};
     int sock {};
@@ -32,13 +54,14 @@ auto getWineserverPid(QStringView socketPath) -> pid_t
     struct ucred ucred = {};
 
     QByteArray socketPathUtf8 = socketPath.toUtf8();
+    refused = false;
 
     if (socketPathUtf8.size() > sizeof(addr.sun_path) - 1) {
         qWarning("Path is too long for UNIX socket: %s", socketPathUtf8.constData());
         return -1;
     }
 
-    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (sock == -1) {
         qWarning("Unable to create UNIX socket (errno=%d)", errno);
         return -1;
@@ -52,16 +75,17 @@ auto getWineserverPid(QStringView socketPath) -> pid_t
 
     if (connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(struct sockaddr_un)) == -1) { // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
         qDebug("Failed to connect to wineserver socket (errno=%d)", errno);
-        if (errno == ECONNREFUSED) {
-            // The socket is disconnected, so unlink it.
-            // That way we'll get notified when a new wineserver re-creates it.
-            unlink(socketPathUtf8.data());
-        }
+        // Nothing is listening. The socket is left alone: unlinking it could
+        // race with a wineserver that has bound it but not yet listened, and
+        // a new wineserver replaces it anyway, which we get notified of.
+        refused = errno == ECONNREFUSED;
+        close(sock);
         return -1;
     }
 
     if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &ucred, &len) == -1) {
         qDebug("Failed to acquire wineserver socket peer credentials (errno=%d)", errno);
+        close(sock);
         return -1;
     }
 
@@ -73,19 +97,111 @@ auto getWineserverPid(QStringView socketPath) -> pid_t
     return ucred.pid;
 }
 
+/**
+ * Returns whether a process holds the lock in a wineserver directory. A
+ * wineserver takes it before it creates its socket and keeps it until it
+ * exits.
+ */
+auto serverLockHeld(const QString &serverPath) -> bool
+{
+    QByteArray lockPath = QFile::encodeName(QDir { serverPath }.absoluteFilePath("lock"));
+    int lockFd = open(lockPath.constData(), O_RDONLY | O_CLOEXEC);
+    if (lockFd == -1) {
+        return false;
+    }
+    struct flock lock = {};
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    bool held = fcntl(lockFd, F_GETLK, &lock) == 0 && lock.l_type != F_UNLCK;
+    close(lockFd);
+    return held;
+}
+
+/**
+ * Returns whether serverPath is a wineserver directory: a real directory, not
+ * a symlink, named like the ones wineserver creates. Nothing else under the
+ * server prefix is probed or removed.
+ */
+auto isServerDirectory(const QString &serverPath) -> bool
+{
+    QFileInfo info { serverPath };
+    return info.fileName().startsWith("server-") && info.isDir() && !info.isSymLink();
+}
+
+/**
+ * Removes a wineserver directory, provided no wineserver is running in it.
+ * Like wineserver itself, this takes a write lock on the lock file in the
+ * directory; a running wineserver holds that lock for as long as it runs.
+ */
+auto removeServerDirectory(const QString &serverPath) -> bool
+{
+    QByteArray lockPath = QFile::encodeName(QDir { serverPath }.absoluteFilePath("lock"));
+    int lockFd = open(lockPath.constData(), O_WRONLY | O_CLOEXEC);
+    if (lockFd == -1 && errno != ENOENT) {
+        return false;
+    }
+    if (lockFd != -1) {
+        struct flock lock = {};
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        if (fcntl(lockFd, F_SETLK, &lock) == -1) {
+            close(lockFd);
+            return false;
+        }
+    }
+
+    QDir serverDirectory { serverPath };
+    const QStringList entries
+            = serverDirectory.entryList(QDir::NoDotAndDotDot | QDir::AllEntries | QDir::Hidden | QDir::System);
+    for (const QString &entry : entries) {
+        if (entry != "lock") {
+            serverDirectory.remove(entry);
+        }
+    }
+    serverDirectory.remove("lock");
+    bool removed = QDir {}.rmdir(serverPath);
+
+    if (lockFd != -1) {
+        close(lockFd);
+    }
+    return removed;
+}
+
 }
 
-WineMonitorLinux::WineMonitorLinux(QObject *parent) : WineMonitor(parent)
+WineMonitorLinux::WineMonitorLinux(QObject *parent)
+    : WineMonitorLinux(kWineServerPrefixFormat.arg(QString::number(getuid())),
+            QDir { QStandardPaths::writableLocation(QStandardPaths::CacheLocation) }.absoluteFilePath("probe-index"),
+            parent)
+{
+    namespaceDiscovery_ = true;
+}
+
+WineMonitorLinux::WineMonitorLinux(const QString &serverPrefix, const QString &indexPath, QObject *parent)
+    : WineMonitor(parent)
+    , serverPrefix_ { serverPrefix }
+    , indexPath_ { indexPath }
+    , sandboxPrefix_ { kWineServerPrefixFormat.arg(QString::number(getuid())) }
 {
-    serverPrefix_ = kWineServerPrefixFormat.arg(QString::number(getuid()));
     if (!QDir { serverPrefix_ }.exists()) {
         qInfo("Creating wine server directory at %s", qPrintable(serverPrefix_));
         QDir {}.mkdir(serverPrefix_, QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ExeOwner);
     }
+    loadIndex();
+    collectTimer_.setInterval(kCollectIntervalMs);
+    QObject::connect(&collectTimer_, &QTimer::timeout, this, &WineMonitorLinux::collectStaleDirectories);
+    discoverTimer_.setSingleShot(true);
+    discoverTimer_.setInterval(kDiscoverDelayMs);
+    QObject::connect(&discoverTimer_, &QTimer::timeout, this, &WineMonitorLinux::discoverNamespaces);
 }
 
 WineMonitorLinux::~WineMonitorLinux()
 {
+    for (const auto &root : std::as_const(namespaceRoots_)) {
+        root.exitNotifier->setEnabled(false);
+        close(static_cast<int>(root.exitNotifier->socket()));
+    }
+
     if (epollFd_ != -1) {
         struct epoll_event closeEvent = {};
         closeEvent.events = EPOLLIN;
@@ -118,44 +234,374 @@ void WineMonitorLinux::start()
 
     epollFd_ = epoll_create(kEpollSize);
 
-    checkWineserverDirectories();
+    checkWineserverDirectories(serverPrefix_);
+    if (namespaceDiscovery_) {
+        watchForSandboxes();
+        discoverNamespaces();
+    }
     emit initialized();
 
     epollThread_.reset(QThread::create([&] { epollThread(); }));
     epollThread_->start();
+
+    collectStaleDirectories();
+    collectTimer_.start();
+}
+
+auto WineMonitorLinux::probeCount() const -> qint64
+{
+    return probes_;
+}
+
+void WineMonitorLinux::setNamespaceDiscovery(bool enabled)
+{
+    namespaceDiscovery_ = enabled;
+}
+
+auto WineMonitorLinux::namespaceCount() const -> qsizetype
+{
+    return namespaceRoots_.size();
+}
+
+void WineMonitorLinux::watchForSandboxes()
+{
+    // Flatpak registers each running sandbox in $XDG_RUNTIME_DIR/.flatpak.
+    // Until that exists, watch for it to be created.
+    QString runtimeDirectory = qEnvironmentVariable("XDG_RUNTIME_DIR");
+    if (runtimeDirectory.isEmpty()) {
+        return;
+    }
+    QString flatpakDirectory = QDir { runtimeDirectory }.absoluteFilePath(".flatpak");
+    if (!discoveryWatchPath_.isEmpty()) {
+        serverWatcher_->removePath(discoveryWatchPath_);
+    }
+    discoveryWatchPath_ = QFileInfo { flatpakDirectory }.isDir() ? flatpakDirectory : runtimeDirectory;
+    serverWatcher_->addPath(discoveryWatchPath_);
+}
+
+void WineMonitorLinux::discoverNamespaces()
+{
+    if (!namespaceDiscovery_ || serverWatcher_ == nullptr) {
+        return;
+    }
+
+    // Sandboxes have a mount namespace of their own, and so their own /tmp.
+    // Each namespace is only looked into once, through the first process
+    // found in it whose parent is outside of it.
+    QSet<QByteArray> checked { processMountNamespace(getpid()) };
+    uid_t uid = getuid();
+    for (const QString &entry : QDir { "/proc" }.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        bool ok = false;
+        pid_t pid = entry.toInt(&ok);
+        struct stat procStat = {};
+        if (!ok || stat(QByteArray { "/proc/" + entry.toLatin1() }.constData(), &procStat) == -1
+                || procStat.st_uid != uid) {
+            continue;
+        }
+
+        QByteArray mountNs = processMountNamespace(pid);
+        if (mountNs.isEmpty() || checked.contains(mountNs) || namespaceRoots_.contains(mountNs)) {
+            continue;
+        }
+        if (processMountNamespace(processParentPid(pid)) == mountNs) {
+            continue;
+        }
+        checked.insert(mountNs);
+        addNamespaceRoot(mountNs, pid);
+    }
+}
+
+void WineMonitorLinux::addNamespaceRoot(const QByteArray &mountNamespace, pid_t pid)
+{
+    // Knowing when the process exits tells us when to stop watching,
+    // without having to sweep /proc again.
+    int pidfd = pidfd_open(pid, 0);
+    if (pidfd == -1) {
+        return;
+    }
+    auto *exitNotifier = new QSocketNotifier(pidfd, QSocketNotifier::Read, this);
+    QObject::connect(exitNotifier, &QSocketNotifier::activated, this, [this, mountNamespace] {
+        removeNamespaceRoot(mountNamespace);
+    });
+
+    // Sandboxes that share our /tmp, as pressure-vessel does by default, are
+    // already covered by the main directory. /tmp itself is compared, since
+    // the server directory may not exist on either side yet.
+    QString root = QString { "/proc/%1/root" }.arg(pid) + sandboxPrefix_;
+    QString tmpPath = QFileInfo { root }.path();
+    struct stat tmpStat = {};
+    struct stat ownStat = {};
+    bool shared = stat(QFile::encodeName(tmpPath).constData(), &tmpStat) == -1
+            || (stat(QFile::encodeName(QFileInfo { serverPrefix_ }.absolutePath()).constData(), &ownStat) == 0
+                    && tmpStat.st_dev == ownStat.st_dev && tmpStat.st_ino == ownStat.st_ino);
+    for (const auto &other : std::as_const(namespaceRoots_)) {
+        shared = shared || (other.device == tmpStat.st_dev && other.inode == tmpStat.st_ino);
+    }
+
+    namespaceRoots_.insert(mountNamespace,
+            NamespaceRoot {
+                    .pid = pid,
+                    .path = shared ? QString {} : root,
+                    .tmpPath = shared ? QString {} : tmpPath,
+                    .device = tmpStat.st_dev,
+                    .inode = tmpStat.st_ino,
+                    .exitNotifier = exitNotifier,
+            });
+    if (shared) {
+        return;
+    }
+
+    qDebug("Watching %s for wineservers in mount namespace %s", qPrintable(root), mountNamespace.constData());
+    updateNamespaceWatch(mountNamespace);
+}
+
+void WineMonitorLinux::updateNamespaceWatch(const QByteArray &mountNamespace)
+{
+    auto it = namespaceRoots_.find(mountNamespace);
+    if (it == namespaceRoots_.end() || it->path.isEmpty()) {
+        return;
+    }
+
+    // The server directory is not ours to create in somebody else's /tmp, so
+    // until Wine creates it, the sandbox's /tmp is watched instead.
+    bool exists = QFileInfo { it->path }.isDir();
+    QString watchPath = exists ? it->path : it->tmpPath;
+    bool moved = watchPath != it->watchPath;
+    if (moved) {
+        if (!it->watchPath.isEmpty()) {
+            serverWatcher_->removePath(it->watchPath);
+        }
+        serverWatcher_->addPath(watchPath);
+        it->watchPath = watchPath;
+    }
+    if (exists || moved) {
+        checkWineserverDirectories(it->path);
+    }
 }
 
-void WineMonitorLinux::checkWineserverDirectories()
+void WineMonitorLinux::removeNamespaceRoot(const QByteArray &mountNamespace)
 {
-    QDir wineserverParentDirectory { serverPrefix_ };
+    auto it = namespaceRoots_.find(mountNamespace);
+    if (it == namespaceRoots_.end()) {
+        return;
+    }
+    NamespaceRoot root = it.value();
+    namespaceRoots_.erase(it);
+
+    root.exitNotifier->setEnabled(false);
+    close(static_cast<int>(root.exitNotifier->socket()));
+    root.exitNotifier->deleteLater();
+
+    if (root.path.isEmpty()) {
+        return;
+    }
+    qDebug("Mount namespace %s has gone away", mountNamespace.constData());
+    serverWatcher_->removePath(root.watchPath);
+    const QSet<QString> known = knownDirectories_;
+    for (const QString &serverPath : known) {
+        if (QFileInfo { serverPath }.absolutePath() == root.path) {
+            serverWatcher_->removePath(serverPath);
+            forgetDirectory(serverPath);
+        }
+    }
+}
 
-    for (const QString &filePath :
-         wineserverParentDirectory.entryList(QDir::NoDotAndDotDot | QDir::Dirs | QDir::Files | QDir::Hidden)) {
-        checkWineserverDirectory(wineserverParentDirectory.absoluteFilePath(filePath));
+void WineMonitorLinux::checkWineserverDirectories(const QString &root)
+{
+    QDir wineserverParentDirectory { root };
+    QString rootPath = wineserverParentDirectory.absolutePath();
+
+    // Directories that were already there have their own watches, so only
+    // new ones need probing.
+    QSet<QString> present;
+    const QStringList names = wineserverParentDirectory.entryList(
+            { "server-*" }, QDir::NoDotAndDotDot | QDir::Dirs | QDir::Hidden | QDir::NoSymLinks);
+    for (const QString &name : names) {
+        QString serverPath = wineserverParentDirectory.absoluteFilePath(name);
+        present.insert(serverPath);
+        if (!knownDirectories_.contains(serverPath)) {
+            checkWineserverDirectory(serverPath);
+        }
+    }
+    const QSet<QString> known = knownDirectories_;
+    for (const QString &serverPath : known) {
+        if (!present.contains(serverPath) && QFileInfo { serverPath }.absolutePath() == rootPath) {
+            forgetDirectory(serverPath);
+        }
     }
+
+    saveIndex();
 }
 
 void WineMonitorLinux::checkWineserverDirectory(const QString &serverPath)
 {
-    QDir wineserverDirectory { serverPath };
-    if (!wineserverDirectory.exists()) {
+    if (!isServerDirectory(serverPath)) {
+        forgetDirectory(serverPath);
         return;
     }
 
+    knownDirectories_.insert(serverPath);
     serverWatcher_->addPath(serverPath);
 
-    QFile socketFile { wineserverDirectory.absoluteFilePath("socket") };
-    if (!socketFile.exists()) {
+    QString socketPath = QDir { serverPath }.absoluteFilePath("socket");
+    struct stat socketStat = {};
+    if (lstat(QFile::encodeName(socketPath).constData(), &socketStat) == -1) {
+        deadDirectories_.insert(serverPath);
+        indexDirty_ |= deadSockets_.remove(serverPath) > 0;
         return;
     }
 
-    pid_t wineserverPid = getWineserverPid(socketFile.fileName());
+    // A socket that refused a connection before stays dead; a wineserver
+    // starting in the directory creates a new one.
+    ProbeKey key {
+        .inode = socketStat.st_ino,
+        .mtimeNs = socketStat.st_mtim.tv_sec * 1000000000LL + socketStat.st_mtim.tv_nsec,
+    };
+    auto deadSocket = deadSockets_.constFind(serverPath);
+    if (deadSocket != deadSockets_.cend() && *deadSocket == key) {
+        deadDirectories_.insert(serverPath);
+        return;
+    }
+
+    bool refused = false;
+    probes_++;
+    pid_t wineserverPid = getWineserverPid(socketPath, refused);
     if (wineserverPid < 0) {
+        if (!refused) {
+            return;
+        }
+
+        // A refusal alone does not mean the server is gone: it may be
+        // between binding and listening. Only a socket with nobody holding
+        // the lock is known to be dead.
+        if (serverLockHeld(serverPath)) {
+            int attempt = reprobes_.value(serverPath) + 1;
+            if (attempt <= kMaxReprobes) {
+                reprobes_.insert(serverPath, attempt);
+                QTimer::singleShot(kReprobeDelayMs, this, [this, serverPath] {
+                    if (reprobes_.contains(serverPath)) {
+                        checkWineserverDirectory(serverPath);
+                        saveIndex();
+                    }
+                });
+            } else {
+                qWarning("Wineserver in %s holds its lock but does not accept connections", qPrintable(serverPath));
+                reprobes_.remove(serverPath);
+                deadDirectories_.insert(serverPath);
+            }
+            return;
+        }
+        reprobes_.remove(serverPath);
+        deadDirectories_.insert(serverPath);
+        deadSockets_.insert(serverPath, key);
+        indexDirty_ = true;
         return;
     }
+
+    reprobes_.remove(serverPath);
+    deadDirectories_.remove(serverPath);
+    indexDirty_ |= deadSockets_.remove(serverPath) > 0;
     addWineserverProcessToEpoll(wineserverPid);
 }
 
+void WineMonitorLinux::forgetDirectory(const QString &serverPath)
+{
+    knownDirectories_.remove(serverPath);
+    reprobes_.remove(serverPath);
+    deadDirectories_.remove(serverPath);
+    indexDirty_ |= deadSockets_.remove(serverPath) > 0;
+}
+
+void WineMonitorLinux::collectStaleDirectories()
+{
+    if (serverWatcher_ == nullptr) {
+        return;
+    }
+
+    // Sandboxed /tmp directories go away with their sandbox, so only our own
+    // is cleaned up.
+    QString rootPath = QDir { serverPrefix_ }.absolutePath();
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    int removed = 0;
+
+    const QSet<QString> candidates = deadDirectories_;
+    for (const QString &serverPath : candidates) {
+        QFileInfo directoryInfo { serverPath };
+        if (directoryInfo.absolutePath() != rootPath || !isServerDirectory(serverPath)
+                || now - directoryInfo.lastModified().toMSecsSinceEpoch() < kStaleGraceMs) {
+            continue;
+        }
+
+        serverWatcher_->removePath(serverPath);
+        if (removeServerDirectory(serverPath)) {
+            forgetDirectory(serverPath);
+            removed++;
+        } else {
+            // Most likely a wineserver has just started in it.
+            checkWineserverDirectory(serverPath);
+        }
+    }
+
+    if (removed > 0) {
+        qInfo("Removed %d stale wineserver directories", removed);
+    }
+    saveIndex();
+}
+
+void WineMonitorLinux::loadIndex()
+{
+    if (indexPath_.isEmpty()) {
+        return;
+    }
+    QFile indexFile { indexPath_ };
+    if (!indexFile.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    // Each line is "<inode> <mtime in ns> <directory path>".
+    for (const auto &line : indexFile.readAll().split('\n')) {
+        auto inodeEnd = line.indexOf(' ');
+        auto mtimeEnd = line.indexOf(' ', inodeEnd + 1);
+        if (inodeEnd == -1 || mtimeEnd == -1) {
+            continue;
+        }
+        deadSockets_.insert(QFile::decodeName(line.sliced(mtimeEnd + 1)),
+                ProbeKey {
+                        .inode = line.first(inodeEnd).toULongLong(),
+                        .mtimeNs = line.sliced(inodeEnd + 1, mtimeEnd - inodeEnd - 1).toLongLong(),
+                });
+    }
+
+    // Saving drops entries for directories that no longer exist.
+    indexDirty_ = !deadSockets_.isEmpty();
+}
+
+void WineMonitorLinux::saveIndex()
+{
+    if (indexPath_.isEmpty() || !indexDirty_) {
+        return;
+    }
+
+    QDir {}.mkpath(QFileInfo { indexPath_ }.absolutePath());
+    QSaveFile indexFile { indexPath_ };
+    if (!indexFile.open(QIODevice::WriteOnly)) {
+        qWarning("Unable to save wineserver probe index to %s", qPrintable(indexPath_));
+        return;
+    }
+    // Only our own directory outlives this process; sandboxes do not.
+    QString rootPath = QDir { serverPrefix_ }.absolutePath();
+    for (auto it = deadSockets_.cbegin(); it != deadSockets_.cend(); ++it) {
+        if (!knownDirectories_.contains(it.key()) || QFileInfo { it.key() }.absolutePath() != rootPath) {
+            continue;
+        }
+        indexFile.write(QByteArray::number(it->inode) + ' ' + QByteArray::number(it->mtimeNs) + ' '
+                + QFile::encodeName(it.key()) + '\n');
+    }
+    if (indexFile.commit()) {
+        indexDirty_ = false;
+    }
+}
+
 void WineMonitorLinux::addWineserverProcessToEpoll(pid_t pid)
 {
     if (havePid(pid)) {
@@ -254,10 +700,32 @@ auto WineMonitorLinux::havePid(pid_t pid) -> bool
 
 void WineMonitorLinux::directoryChanged(const QString &path)
 {
+    if (path == discoveryWatchPath_) {
+        // While waiting for .flatpak to appear, other changes to the runtime
+        // directory are of no interest.
+        if (!path.endsWith("/.flatpak")) {
+            watchForSandboxes();
+        }
+        if (discoveryWatchPath_.endsWith("/.flatpak")) {
+            discoverTimer_.start();
+        }
+        return;
+    }
+
+    // Paths under /proc/<pid>/root are compared as strings, since comparing
+    // QFileInfos would resolve them to the same path as our own directory.
+    for (auto it = namespaceRoots_.cbegin(); it != namespaceRoots_.cend(); ++it) {
+        if (!it->watchPath.isEmpty() && path == it->watchPath) {
+            updateNamespaceWatch(it.key());
+            return;
+        }
+    }
+
     if (QFileInfo { path } == QFileInfo { serverPrefix_ }) {
-        checkWineserverDirectories();
+        checkWineserverDirectories(serverPrefix_);
     } else {
         checkWineserverDirectory(path);
+        saveIndex();
     }
 }
 
@@ -2,15 +2,19 @@
 
 #include <memory>
 
+#include <QHash>
 #include <QMutex>
 #include <QSet>
 #include <QThread>
+#include <QTimer>
+#include <sys/types.h>
 #include <unistd.h>
 
 #include "winemonitor.h"
 
 QT_BEGIN_NAMESPACE
 class QFileSystemWatcher;
+class QSocketNotifier;
 QT_END_NAMESPACE
 
 class WineMonitorLinux : public WineMonitor
@@ -19,6 +23,16 @@ class WineMonitorLinux : public WineMonitor
 
 public:
     explicit WineMonitorLinux(QObject *parent = nullptr);
+
+    /**
+     * Creates a monitor that watches serverPrefix instead of the default
+     * /tmp/.wine-<uid> directory. Used to run the monitor against fake
+     * wineservers. Sockets known to be dead are remembered across runs in
+     * the file at indexPath, unless it is empty.
+     */
+    explicit WineMonitorLinux(const QT_PREPEND_NAMESPACE(QString) & serverPrefix,
+            const QT_PREPEND_NAMESPACE(QString) & indexPath = {},
+            QObject *parent = nullptr);
     ~WineMonitorLinux() override;
 
     WineMonitorLinux(WineMonitorLinux &) = delete;
@@ -28,9 +42,75 @@ public:
 
     void start() override;
 
+    /**
+     * Returns the number of times a wineserver socket has been connected to.
+     */
+    [[nodiscard]] auto probeCount() const -> qint64;
+
+    /**
+     * Removes server directories that have had no running wineserver for a
+     * while. Runs periodically once the monitor is started.
+     */
+    Q_SLOT void collectStaleDirectories();
+
+    /**
+     * Whether wineservers in other mount namespaces, such as Flatpak
+     * sandboxes, are looked for as well. Enabled by the default constructor.
+     * Sandboxes with a /tmp of their own are found through the /proc/<pid>/root
+     * of the first process in them, and their /tmp/.wine-<uid> is watched for
+     * as long as that process runs, or their /tmp until Wine creates it. The
+     * servers found there are marked sandboxed in the list model.
+     */
+    void setNamespaceDiscovery(bool enabled);
+
+    /**
+     * Looks through /proc for mount namespaces that are not watched yet. Runs
+     * on start and whenever a Flatpak instance is registered.
+     */
+    Q_SLOT void discoverNamespaces();
+
+    /**
+     * Returns the number of other mount namespaces found so far.
+     */
+    [[nodiscard]] auto namespaceCount() const -> qsizetype;
+
 private:
-    void checkWineserverDirectories();
+    // Identifies a socket file; a new wineserver always creates a new one.
+    struct ProbeKey
+    {
+        quint64 inode;
+        qint64 mtimeNs;
+
+        auto operator==(const ProbeKey &other) const -> bool
+        {
+            return inode == other.inode && mtimeNs == other.mtimeNs;
+        }
+    };
+
+    // The server directory as seen from a mount namespace, and the process
+    // it is seen through. Namespaces sharing our /tmp have an empty path.
+    // The watched path is either the server directory or, until that
+    // exists, the /tmp it is created in; device and inode are those of /tmp.
+    struct NamespaceRoot
+    {
+        pid_t pid;
+        QT_PREPEND_NAMESPACE(QString) path;
+        QT_PREPEND_NAMESPACE(QString) tmpPath;
+        QT_PREPEND_NAMESPACE(QString) watchPath;
+        dev_t device;
+        ino_t inode;
+        QT_PREPEND_NAMESPACE(QSocketNotifier) *exitNotifier;
+    };
+
+    void checkWineserverDirectories(const QString &root);
     void checkWineserverDirectory(const QString &serverPath);
+    void forgetDirectory(const QString &serverPath);
+    void watchForSandboxes();
+    void addNamespaceRoot(const QByteArray &mountNamespace, pid_t pid);
+    void updateNamespaceWatch(const QByteArray &mountNamespace);
+    void removeNamespaceRoot(const QByteArray &mountNamespace);
+    void loadIndex();
+    void saveIndex();
     void addWineserverProcessToEpoll(pid_t pid);
     Q_SLOT void directoryChanged(const QT_PREPEND_NAMESPACE(QString) & path);
     Q_SLOT void fileChanged(const QT_PREPEND_NAMESPACE(QString) & path);
@@ -50,6 +130,30 @@ private:
     QT_PREPEND_NAMESPACE(QString) serverPrefix_;
     int epollFd_ = -1;
 
+    // Paths of the server directories seen so far; only new ones are probed
+    // when the prefix directory changes.
+    QT_PREPEND_NAMESPACE(QSet)<QString> knownDirectories_;
+
+    // Server directories with no running wineserver, and the sockets in
+    // them that refused a connection, keyed by directory path.
+    QT_PREPEND_NAMESPACE(QSet)<QString> deadDirectories_;
+    QT_PREPEND_NAMESPACE(QHash)<QString, ProbeKey> deadSockets_;
+    QT_PREPEND_NAMESPACE(QString) indexPath_;
+    bool indexDirty_ {};
+
+    // Directories whose socket refused a connection while the lock was held,
+    // with the number of times they have been probed again since.
+    QT_PREPEND_NAMESPACE(QHash)<QString, int> reprobes_;
+    qint64 probes_ {};
+    QT_PREPEND_NAMESPACE(QTimer) collectTimer_;
+
+    // Other mount namespaces, keyed by their /proc/<pid>/ns/mnt link.
+    bool namespaceDiscovery_ {};
+    QT_PREPEND_NAMESPACE(QString) sandboxPrefix_;
+    QT_PREPEND_NAMESPACE(QString) discoveryWatchPath_;
+    QT_PREPEND_NAMESPACE(QHash)<QByteArray, NamespaceRoot> namespaceRoots_;
+    QT_PREPEND_NAMESPACE(QTimer) discoverTimer_;
+
     QT_PREPEND_NAMESPACE(QSet)<pid_t> wineservers_;
     QT_PREPEND_NAMESPACE(QMutex) wineserversMutex_;
     std::unique_ptr<QT_PREPEND_NAMESPACE(QThread)> epollThread_;
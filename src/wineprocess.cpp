@@ -0,0 +1,266 @@
+#include <sys/sysinfo.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+
+#include "wineprocess.h"
+
+QT_USE_NAMESPACE
+
+namespace {
+
+// Returns the value of name in the contents of a /proc/<pid>/environ file,
+// which starts with a NUL added by the caller, or a null QByteArray.
+auto environmentValue(const QByteArray &environmentData, QByteArrayView name) -> QByteArray
+{
+    // Search for \0NAME= so that we don't need to split the whole block.
+    QByteArray needle = QByteArray(1, '\0') + name.toByteArray() + '=';
+    auto start = environmentData.indexOf(needle);
+    if (start == -1) {
+        return {};
+    }
+    start += needle.size();
+    auto end = environmentData.indexOf('\0', start);
+    if (end == -1) {
+        end = environmentData.size();
+    }
+
+    // A variable that is set but empty is returned as an empty, non-null
+    // QByteArray.
+    return end == start ? QByteArray { "" } : environmentData.sliced(start, end - start);
+}
+
+auto readEnvironment(pid_t pid) -> QByteArray
+{
+    QFile environFile { QString { "/proc/%1/environ" }.arg(pid) };
+    if (!environFile.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    return QByteArray(1, '\0') + environFile.readAll();
+}
+
+// Returns whether a file name is that of the Wine loader or preloader, which
+// every Wine client process runs as.
+auto isWineLoaderName(QStringView fileName) -> bool
+{
+    static const QStringList kLoaderNames { "wine", "wine64", "wine-preloader", "wine64-preloader" };
+    return kLoaderNames.contains(fileName);
+}
+
+}
+
+auto processEnvironmentValue(pid_t pid, QByteArrayView name) -> QByteArray
+{
+    QByteArray environmentData = readEnvironment(pid);
+    if (environmentData.isNull()) {
+        return {};
+    }
+    return environmentValue(environmentData, name);
+}
+
+auto processWinePrefix(pid_t pid) -> QString
+{
+    QByteArray environmentData = readEnvironment(pid);
+    if (environmentData.isNull()) {
+        return {};
+    }
+
+    // Wine uses $HOME/.wine when WINEPREFIX is unset or empty.
+    QByteArray prefix = environmentValue(environmentData, "WINEPREFIX");
+    if (prefix.isEmpty()) {
+        QByteArray home = environmentValue(environmentData, "HOME");
+        if (home.isEmpty()) {
+            return {};
+        }
+        prefix = home + "/.wine";
+    }
+    return QDir::cleanPath(QString::fromUtf8(prefix));
+}
+
+auto processResidentBytes(pid_t pid) -> qint64
+{
+    QFile statmFile { QString { "/proc/%1/statm" }.arg(pid) };
+    if (!statmFile.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+
+    // statm is "size resident shared text lib data dt", in pages.
+    auto fields = statmFile.readAll().split(' ');
+    if (fields.size() < 2) {
+        return 0;
+    }
+    static const qint64 kPageSize = sysconf(_SC_PAGESIZE);
+    return fields.at(1).toLongLong() * kPageSize;
+}
+
+auto processCpuTimeUs(pid_t pid) -> qint64
+{
+    QFile statFile { QString { "/proc/%1/stat" }.arg(pid) };
+    if (!statFile.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+
+    // utime and stime are fields 14 and 15, in clock ticks.
+    QByteArray stat = statFile.readAll();
+    auto fields = stat.sliced(stat.lastIndexOf(')') + 2).split(' ');
+    static constexpr int kUserTimeField = 14 - 3;
+    static constexpr int kSystemTimeField = 15 - 3;
+    if (fields.size() <= kSystemTimeField) {
+        return 0;
+    }
+    static const qint64 kClockTicks = sysconf(_SC_CLK_TCK);
+    qint64 ticks = fields.at(kUserTimeField).toLongLong() + fields.at(kSystemTimeField).toLongLong();
+    return ticks * 1000000 / kClockTicks;
+}
+
+auto processWindowsExeName(pid_t pid) -> QString
+{
+    QFile cmdlineFile { QString { "/proc/%1/cmdline" }.arg(pid) };
+    if (!cmdlineFile.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+
+    // Arguments are separated by NULs. argv[0] is usually a Windows path, but
+    // may be a Unix one if Wine has not replaced it yet.
+    QByteArray argv0 = cmdlineFile.readAll();
+    if (auto end = argv0.indexOf('\0'); end != -1) {
+        argv0.truncate(end);
+    }
+    auto separator = std::max(argv0.lastIndexOf('\\'), argv0.lastIndexOf('/'));
+    return QString::fromUtf8(argv0.sliced(separator + 1));
+}
+
+auto processParentPid(pid_t pid) -> pid_t
+{
+    QFile statFile { QString { "/proc/%1/stat" }.arg(pid) };
+    if (!statFile.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+
+    // ppid is field 4; the field after the paren is field 3.
+    QByteArray stat = statFile.readAll();
+    auto fields = stat.sliced(stat.lastIndexOf(')') + 2).split(' ');
+    static constexpr int kParentPidField = 4 - 3;
+    if (fields.size() <= kParentPidField) {
+        return 0;
+    }
+    return static_cast<pid_t>(fields.at(kParentPidField).toInt());
+}
+
+auto processMountNamespace(pid_t pid) -> QByteArray
+{
+    // The link reads "mnt:[<inode>]".
+    std::array<char, 64> buffer {};
+    QByteArray linkPath = "/proc/" + QByteArray::number(pid) + "/ns/mnt";
+    ssize_t size = readlink(linkPath.constData(), buffer.data(), buffer.size());
+    if (size <= 0) {
+        return {};
+    }
+    return QByteArray { buffer.data(), size };
+}
+
+auto processIsSandboxed(pid_t pid) -> bool
+{
+    static const QByteArray kOwnNamespace = processMountNamespace(getpid());
+    QByteArray mountNamespace = processMountNamespace(pid);
+    return !mountNamespace.isEmpty() && mountNamespace != kOwnNamespace;
+}
+
+auto processStartTimeMs(pid_t pid) -> qint64
+{
+    QFile statFile { QString { "/proc/%1/stat" }.arg(pid) };
+    if (!statFile.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+
+    // The comm field may contain spaces, so start after its closing paren.
+    // starttime is field 22; the field after the paren is field 3.
+    QByteArray stat = statFile.readAll();
+    auto fields = stat.sliced(stat.lastIndexOf(')') + 2).split(' ');
+    static constexpr int kStartTimeField = 22 - 3;
+    if (fields.size() <= kStartTimeField) {
+        return 0;
+    }
+
+    struct sysinfo info = {};
+    if (sysinfo(&info) != 0) {
+        return 0;
+    }
+    static const qint64 kClockTicks = sysconf(_SC_CLK_TCK);
+    qint64 sinceBootMs = fields.at(kStartTimeField).toLongLong() * 1000 / kClockTicks;
+    qint64 bootTimeMs = QDateTime::currentMSecsSinceEpoch() - static_cast<qint64>(info.uptime) * 1000;
+    return bootTimeMs + sinceBootMs;
+}
+
+auto wineClientPids(const QList<pid_t> &serverPids) -> QHash<pid_t, QList<pid_t>>
+{
+    // What a client has to share with its server: the directory of the Wine
+    // installation, the mount namespace it is seen in, and the prefix.
+    struct ServerKey
+    {
+        pid_t pid;
+        QByteArray mountNamespace;
+        QString prefix;
+    };
+
+    QHash<pid_t, QList<pid_t>> result;
+    QHash<QString, QList<ServerKey>> serversByBinDir;
+    for (pid_t serverPid : serverPids) {
+        result.insert(serverPid, {});
+        QString exe = QFileInfo { QString { "/proc/%1/exe" }.arg(serverPid) }.symLinkTarget();
+        QString prefix = processWinePrefix(serverPid);
+        if (exe.isEmpty() || prefix.isEmpty()) {
+            continue;
+        }
+        serversByBinDir[QFileInfo { exe }.absolutePath()].append(ServerKey {
+                .pid = serverPid,
+                .mountNamespace = processMountNamespace(serverPid),
+                .prefix = prefix,
+        });
+    }
+    if (serversByBinDir.isEmpty()) {
+        return result;
+    }
+
+    QDir procDir { "/proc" };
+    for (const QString &entry : procDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        bool ok = false;
+        pid_t pid = entry.toInt(&ok);
+        if (!ok) {
+            continue;
+        }
+
+        // Only the Wine loader from the same installation as the server
+        // counts; other programs next to wineserver, such as everything else
+        // in /usr/bin, are not clients even if they inherited WINEPREFIX.
+        QFileInfo exe { QFileInfo { QString { "/proc/%1/exe" }.arg(pid) }.symLinkTarget() };
+        if (!isWineLoaderName(exe.fileName())) {
+            continue;
+        }
+        auto servers = serversByBinDir.constFind(exe.absolutePath());
+        if (servers == serversByBinDir.cend()) {
+            continue;
+        }
+
+        // The same paths mean different files in different sandboxes.
+        QByteArray mountNamespace = processMountNamespace(pid);
+        QString prefix = processWinePrefix(pid);
+        if (prefix.isEmpty()) {
+            continue;
+        }
+        for (const auto &server : *servers) {
+            if (server.pid != pid && server.mountNamespace == mountNamespace && server.prefix == prefix) {
+                result[server.pid].append(pid);
+                break;
+            }
+        }
+    }
+    return result;
+}
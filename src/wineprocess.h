@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <sys/types.h>
+
+/**
+ * Returns the value of the environment variable name in the environment of
+ * process pid, or a null QByteArray if it is not set or cannot be read. A
+ * variable set to an empty value gives an empty, non-null QByteArray.
+ */
+[[nodiscard]] auto processEnvironmentValue(pid_t pid, QByteArrayView name) -> QByteArray;
+
+/**
+ * Returns the Wine prefix that process pid uses: its WINEPREFIX, or
+ * $HOME/.wine if that is unset or empty, as Wine does. Returns a null QString
+ * if the environment of the process cannot be read.
+ */
+[[nodiscard]] auto processWinePrefix(pid_t pid) -> QString;
+
+/**
+ * Returns the resident set size of process pid in bytes, or 0 if it cannot be
+ * read.
+ */
+[[nodiscard]] auto processResidentBytes(pid_t pid) -> qint64;
+
+/**
+ * Returns the user and system CPU time used by process pid in microseconds,
+ * or 0 if it cannot be read.
+ */
+[[nodiscard]] auto processCpuTimeUs(pid_t pid) -> qint64;
+
+/**
+ * Returns the time process pid was started, in milliseconds since the epoch,
+ * or 0 if it cannot be determined.
+ */
+[[nodiscard]] auto processStartTimeMs(pid_t pid) -> qint64;
+
+/**
+ * Returns the pid of the parent of process pid, or 0 if it cannot be read.
+ */
+[[nodiscard]] auto processParentPid(pid_t pid) -> pid_t;
+
+/**
+ * Returns an identifier for the mount namespace of process pid, equal for
+ * processes in the same namespace, or an empty QByteArray if it cannot be
+ * read.
+ */
+[[nodiscard]] auto processMountNamespace(pid_t pid) -> QByteArray;
+
+/**
+ * Returns whether process pid runs in a different mount namespace than this
+ * process, such as inside a Flatpak sandbox. Paths seen by such a process are
+ * reachable from here under /proc/<pid>/root.
+ */
+[[nodiscard]] auto processIsSandboxed(pid_t pid) -> bool;
+
+/**
+ * Returns the file name of the Windows executable that Wine process pid runs,
+ * such as "explorer.exe", or an empty string if it cannot be read. Wine sets
+ * argv[0] of its processes to the Windows path of the executable.
+ */
+[[nodiscard]] auto processWindowsExeName(pid_t pid) -> QString;
+
+/**
+ * Finds the Wine client processes of each of the given wineservers, by
+ * scanning /proc once for Wine loader processes from the same installation
+ * with the same prefix in the same mount namespace. This costs O(processes)
+ * in the whole system however many servers are given. Returns the clients by
+ * server pid, with an entry for every server.
+ */
+[[nodiscard]] auto wineClientPids(const QList<pid_t> &serverPids) -> QHash<pid_t, QList<pid_t>>;
@@ -1,36 +1,43 @@
 #include <QAbstractItemModel>
+#include <QDateTime>
 #include <QDir>
 #include <QFileInfo>
 #include <QProcess>
+#include <QSet>
 #include <QStringBuilder>
 
+#include <algorithm>
 #include <csignal>
+#include <utility>
 
+#include "cgroupmanager.h"
+#include "wineprocess.h"
 #include "wineserverlist.h"
 
 QT_USE_NAMESPACE
 
+constexpr int kSampleIntervalMs = 10000;
+
+// Servers expanded in a view are sampled more often, since their client
+// processes are on screen.
+constexpr int kExpandedSampleIntervalMs = 1000;
+constexpr qint64 kNsPerMs = 1000000;
+constexpr double kMiB = 1024.0 * 1024.0;
+
 WineServerData::WineServerData(pid_t pid) : pid { pid }
 {
+    // The exe link of a sandboxed process names a path inside its sandbox,
+    // which is only reachable from here through its root.
     QFileInfo exeFile { QString { "/proc/%1/exe" }.arg(pid) };
-    exe = exeFile.canonicalFilePath();
-
-    QFile environFile { QString { "/proc/%1/environ" }.arg(pid) };
-    if (environFile.open(QIODevice::ReadOnly)) {
-        // TODO: This is inefficient out of laziness.
-        // Should probably just do a string search for \0WINEPREFIX= over
-        // blocks of data.
-        auto environmentData = environFile.readAll();
-        auto variables = environmentData.split(0);
-        for (const auto &variableData : variables) {
-            static constexpr QByteArrayView kWinePrefixEnvPrefix { "WINEPREFIX=" };
-            if (variableData.startsWith(kWinePrefixEnvPrefix)) {
-                prefix = { variableData.mid(kWinePrefixEnvPrefix.size()) };
-            }
-        }
-    }
+    sandboxed = processIsSandboxed(pid);
+    exe = sandboxed ? exeFile.symLinkTarget() : exeFile.canonicalFilePath();
+    QString root = sandboxed ? QString { "/proc/%1/root" }.arg(pid) : QString {};
+
+    prefix = QString::fromUtf8(processEnvironmentValue(pid, "WINEPREFIX"));
+    startedMs = processStartTimeMs(pid);
+    peakRss = processResidentBytes(pid);
 
-    QFile wineInf { QFileInfo { exeFile.canonicalFilePath() }.dir().absoluteFilePath("../share/wine/wine.inf") };
+    QFile wineInf { root + QFileInfo { exe }.dir().absoluteFilePath("../share/wine/wine.inf") };
     if (wineInf.open(QIODevice::ReadOnly)) {
         QTextStream stream(&wineInf);
         while (!stream.atEnd()) {
@@ -71,6 +78,13 @@ auto WineServerData::toString() const -> QString
 
 void WineServerData::kill() const
 {
+    // The Wine installation of a sandboxed server cannot be run from outside
+    // its sandbox, but a wineserver shuts down cleanly on SIGTERM, too.
+    if (sandboxed) {
+        ::kill(pid, SIGTERM);
+        return;
+    }
+
     QProcess process;
     process.setProgram(exe);
     process.setArguments({ "-k" });
@@ -79,13 +93,18 @@ void WineServerData::kill() const
         environment.append(QString { "WINEPREFIX=%1" }.arg(prefix));
     }
     process.setEnvironment(environment);
-    process.start();
-    process.waitForStarted();
-    process.waitForFinished();
+
+    // wineserver -k waits for every client to exit, which can take a while.
+    process.startDetached();
 }
 
 void WineServerData::taskmgr() const
 {
+    if (sandboxed) {
+        qWarning("Unable to start the task manager of sandboxed wineserver pid=%d", pid);
+        return;
+    }
+
     QProcess process;
     QDir binDir { QFileInfo { exe }.dir() };
     process.setProgram(binDir.absoluteFilePath("wine"));
@@ -98,48 +117,257 @@ void WineServerData::taskmgr() const
     process.startDetached();
 }
 
-WineServerListModel::WineServerListModel(QObject *parent) : QAbstractListModel(parent) { }
+void WineServerData::setClientPids(const QList<pid_t> &pids)
+{
+    clientPids = pids;
+    clients = static_cast<int>(clientPids.size());
+    peakClients = std::max(peakClients, clients);
+}
+
+void WineServerData::sampleClientProcesses(qint64 elapsedNs)
+{
+    // Clients keep their place and new ones go at the end, so that the rows
+    // shown for them only move when others exit.
+    QSet<pid_t> current { clientPids.begin(), clientPids.end() };
+    clientProcesses.removeIf([&](const WineClientData &client) { return !current.contains(client.pid); });
+    qsizetype known = clientProcesses.size();
+    for (const auto &client : std::as_const(clientProcesses)) {
+        current.remove(client.pid);
+    }
+    for (pid_t clientPid : std::as_const(clientPids)) {
+        if (current.contains(clientPid)) {
+            clientProcesses.append(WineClientData { .pid = clientPid, .name = processWindowsExeName(clientPid) });
+        }
+    }
+
+    for (qsizetype i = 0; i < clientProcesses.size(); i++) {
+        auto &client = clientProcesses[i];
+        qint64 clientCpuTime = processCpuTimeUs(client.pid);
+        if (i < known && elapsedNs > 0) {
+            double cpuTimeNs = static_cast<double>(clientCpuTime - client.cpuTimeUs) * 1000.0;
+            client.cpuPercent = std::max(0.0, cpuTimeNs * 100.0 / static_cast<double>(elapsedNs));
+        }
+        client.cpuTimeUs = clientCpuTime;
+        client.memoryBytes = processResidentBytes(client.pid);
+    }
+}
+
+void WineServerData::sumUsage()
+{
+    qint64 rss = processResidentBytes(pid);
+    qint64 cpuTime = processCpuTimeUs(pid);
+
+    // Reuse the per-client figures if they have just been sampled.
+    if (clientProcesses.size() == clientPids.size()) {
+        for (const auto &client : std::as_const(clientProcesses)) {
+            rss += client.memoryBytes;
+            cpuTime += client.cpuTimeUs;
+        }
+    } else {
+        for (pid_t clientPid : std::as_const(clientPids)) {
+            rss += processResidentBytes(clientPid);
+            cpuTime += processCpuTimeUs(clientPid);
+        }
+    }
+    memoryBytes = rss;
+    cpuTimeUs = cpuTime;
+}
+
+WineServerListModel::WineServerListModel(QObject *parent) : QAbstractItemModel(parent)
+{
+    clock_.start();
+    sampleTimer_.setInterval(kSampleIntervalMs);
+    QObject::connect(&sampleTimer_, &QTimer::timeout, this, &WineServerListModel::sampleServers);
+}
+
+auto WineServerListModel::index(int row, int column, const QModelIndex &parent) const -> QModelIndex
+{
+    if (!hasIndex(row, column, parent)) {
+        return {};
+    }
+
+    // Servers have an internal id of 0, and clients the pid of their server.
+    if (!parent.isValid()) {
+        return createIndex(row, column, quintptr { 0 });
+    }
+    return createIndex(row, column, static_cast<quintptr>(listData_.at(parent.row()).pid));
+}
+
+auto WineServerListModel::parent(const QModelIndex &child) const -> QModelIndex
+{
+    if (!child.isValid() || child.internalId() == 0) {
+        return {};
+    }
+
+    int row = rowForPid(static_cast<pid_t>(child.internalId()));
+    if (row == -1) {
+        return {};
+    }
+    return createIndex(row, 0, quintptr { 0 });
+}
 
 auto WineServerListModel::rowCount(const QModelIndex &parent) const -> int
 {
-    if (parent.isValid()) {
+    if (!parent.isValid()) {
+        return static_cast<int>(listData_.count());
+    }
+    if (!isServer(parent) || parent.column() != 0) {
         return 0;
     }
 
-    return static_cast<int>(listData_.count());
+    const auto &server = listData_.at(parent.row());
+    return fetched_.contains(server.pid) ? static_cast<int>(server.clientProcesses.size()) : 0;
 }
 
-auto WineServerListModel::columnCount(const QModelIndex &parent) const -> int
+auto WineServerListModel::columnCount(const QModelIndex & /*parent*/) const -> int
 {
-    if (parent.isValid()) {
-        return 0;
+    return 6;
+}
+
+auto WineServerListModel::hasChildren(const QModelIndex &parent) const -> bool
+{
+    if (!parent.isValid()) {
+        return !listData_.isEmpty();
+    }
+    if (!isServer(parent) || parent.column() != 0) {
+        return false;
+    }
+
+    const auto &server = listData_.at(parent.row());
+    return !server.clientPids.isEmpty();
+}
+
+auto WineServerListModel::canFetchMore(const QModelIndex &parent) const -> bool
+{
+    if (!isServer(parent) || parent.column() != 0) {
+        return false;
+    }
+
+    const auto &server = listData_.at(parent.row());
+    return !fetched_.contains(server.pid) && !server.clientPids.isEmpty();
+}
+
+void WineServerListModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent)) {
+        return;
     }
 
-    return 4;
+    // Client processes are only read for expanded servers.
+    auto &server = listData_[parent.row()];
+    server.sampleClientProcesses(0);
+    beginInsertRows(parent, 0, static_cast<int>(server.clientProcesses.size()) - 1);
+    fetched_.insert(server.pid);
+    endInsertRows();
+    updateSampleInterval();
+}
+
+void WineServerListModel::discardChildren(const QModelIndex &parent)
+{
+    if (!parent.isValid()) {
+        for (int row = 0; row < listData_.size(); row++) {
+            discardChildren(index(row, 0));
+        }
+        return;
+    }
+    if (!isServer(parent)) {
+        return;
+    }
+
+    auto &server = listData_[parent.row()];
+    if (!fetched_.contains(server.pid)) {
+        return;
+    }
+    int count = rowCount(parent);
+    if (count > 0) {
+        beginRemoveRows(parent, 0, count - 1);
+        fetched_.remove(server.pid);
+        server.clientProcesses.clear();
+        endRemoveRows();
+    } else {
+        fetched_.remove(server.pid);
+        server.clientProcesses.clear();
+    }
+    updateSampleInterval();
 }
 
 auto WineServerListModel::data(const QModelIndex &index, int role) const -> QVariant
 {
-    if (index.parent().isValid() || index.row() < 0 || index.row() >= rowCount() || role != Qt::DisplayRole) {
+    if (!index.isValid()) {
+        return {};
+    }
+    if (!isServer(index)) {
+        return clientData(index, role);
+    }
+    if (index.row() >= listData_.size()) {
         return {};
     }
 
     const auto &row = listData_.at(index.row());
 
+    if (role == PrewarmedRole) {
+        return row.prewarmed;
+    }
+    if (role != Qt::DisplayRole) {
+        return {};
+    }
+
     switch (index.column()) {
     case 0:
+        if (row.prewarmed && !row.prewarmUsed) {
+            return QString { "%1 (prewarmed)" }.arg(row.package);
+        }
+        if (row.sandboxed) {
+            return QString { "%1 (sandboxed)" }.arg(row.package);
+        }
         return row.package;
     case 1:
         return row.prefix;
     case 2:
         return QString::number(row.pid);
     case 3:
+        if (row.sampledNs == 0) {
+            return {};
+        }
+        return QString { "%1%" }.arg(row.cpuPercent, 0, 'f', 1);
+    case 4:
+        if (row.sampledNs == 0) {
+            return {};
+        }
+        return QString { "%1 MiB" }.arg(static_cast<double>(row.memoryBytes) / kMiB, 0, 'f', 1);
+    case 5:
         return row.exe;
     default:
         return {};
     }
 }
 
+auto WineServerListModel::clientData(const QModelIndex &index, int role) const -> QVariant
+{
+    const QModelIndex serverIndex = parent(index);
+    if (!serverIndex.isValid() || role != Qt::DisplayRole) {
+        return {};
+    }
+    const auto &clientProcesses = listData_.at(serverIndex.row()).clientProcesses;
+    if (index.row() < 0 || index.row() >= clientProcesses.size()) {
+        return {};
+    }
+
+    const auto &client = clientProcesses.at(index.row());
+    switch (index.column()) {
+    case 0:
+        return client.name;
+    case 2:
+        return QString::number(client.pid);
+    case 3:
+        return QString { "%1%" }.arg(client.cpuPercent, 0, 'f', 1);
+    case 4:
+        return QString { "%1 MiB" }.arg(static_cast<double>(client.memoryBytes) / kMiB, 0, 'f', 1);
+    default:
+        return {};
+    }
+}
+
 auto WineServerListModel::headerData(int section, Qt::Orientation orientation, int role) const -> QVariant
 {
     if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
@@ -154,6 +382,10 @@ auto WineServerListModel::headerData(int section, Qt::Orientation orientation, i
     case 2:
         return "PID";
     case 3:
+        return "CPU";
+    case 4:
+        return "Memory";
+    case 5:
         return "Server Path";
     default:
         return {};
@@ -165,12 +397,44 @@ auto WineServerListModel::server(int row) -> WineServerData &
     return listData_[row];
 }
 
+auto WineServerListModel::serverRow(const QModelIndex &index) const -> int
+{
+    if (!index.isValid()) {
+        return -1;
+    }
+    return isServer(index) ? index.row() : rowForPid(static_cast<pid_t>(index.internalId()));
+}
+
+auto WineServerListModel::isServer(const QModelIndex &index) -> bool
+{
+    return index.isValid() && index.internalId() == 0;
+}
+
+auto WineServerListModel::rowForPid(pid_t pid) const -> int
+{
+    for (int row = 0; row < listData_.size(); row++) {
+        if (listData_.at(row).pid == pid) {
+            return row;
+        }
+    }
+    return -1;
+}
+
+void WineServerListModel::setCgroupManager(CgroupManager *cgroupManager)
+{
+    cgroupManager_ = cgroupManager;
+}
+
 void WineServerListModel::serverRunning(pid_t pid)
 {
     int newIndex = static_cast<int>(listData_.size());
     beginInsertRows(QModelIndex {}, newIndex, newIndex);
     listData_.append(WineServerData { pid });
     endInsertRows();
+
+    if (!sampleTimer_.isActive()) {
+        sampleTimer_.start();
+    }
 }
 
 void WineServerListModel::serverStopped(pid_t pid, bool lastServer)
@@ -181,10 +445,180 @@ void WineServerListModel::serverStopped(pid_t pid, bool lastServer)
 
     while (iterator.hasNext()) {
         if (iterator.next().pid == pid) {
+            emit serverEnded(iterator.value());
             beginRemoveRows(QModelIndex {}, row, row);
             iterator.remove();
+            fetched_.remove(pid);
             endRemoveRows();
+            continue;
         }
         row++;
     }
+
+    if (listData_.isEmpty()) {
+        sampleTimer_.stop();
+    }
+    updateSampleInterval();
+}
+
+void WineServerListModel::setPrewarmed(pid_t pid)
+{
+    for (int row = 0; row < listData_.size(); row++) {
+        if (listData_[row].pid == pid) {
+            listData_[row].prewarmed = true;
+            emit dataChanged(index(row, 0), index(row, columnCount() - 1));
+        }
+    }
+}
+
+void WineServerListModel::updateSampleInterval()
+{
+    int interval = fetched_.isEmpty() ? kSampleIntervalMs : kExpandedSampleIntervalMs;
+    if (sampleTimer_.interval() != interval) {
+        sampleTimer_.setInterval(interval);
+    }
+}
+
+void WineServerListModel::sampleServers()
+{
+    // Allow for timer jitter when deciding whether a server that is not
+    // expanded is due.
+    static constexpr qint64 kSampleIntervalNs = (kSampleIntervalMs - kExpandedSampleIntervalMs / 2) * kNsPerMs;
+
+    qint64 now = clock_.nsecsElapsed();
+    QList<int> dueRows;
+    QList<pid_t> scanPids;
+    for (int row = 0; row < listData_.size(); row++) {
+        const auto &server = listData_.at(row);
+        if (fetched_.contains(server.pid) || server.sampledNs == 0 || now - server.sampledNs >= kSampleIntervalNs) {
+            dueRows.append(row);
+        }
+        if (server.scannedNs == 0 || now - server.scannedNs >= kSampleIntervalNs) {
+            scanPids.append(server.pid);
+        }
+    }
+    if (dueRows.isEmpty()) {
+        return;
+    }
+
+    // One pass over /proc finds the clients of every server that has not
+    // been scanned for a while. It is needed even for servers with a cgroup,
+    // to find clients started from outside of it. Expanded servers are
+    // sampled more often than that, and in between keep the clients they
+    // had, less those that have exited.
+    QHash<pid_t, QList<pid_t>> clientPids;
+    if (!scanPids.isEmpty()) {
+        clientPids = wineClientPids(scanPids);
+    }
+
+    for (int row : std::as_const(dueRows)) {
+        auto &server = listData_[row];
+        bool expanded = fetched_.contains(server.pid);
+
+        QList<pid_t> pids;
+        if (auto scanned = clientPids.constFind(server.pid); scanned != clientPids.cend()) {
+            pids = *scanned;
+            server.scannedNs = now;
+        } else {
+            pids = server.clientPids;
+            pids.removeIf([](pid_t pid) { return !QFileInfo::exists(QString { "/proc/%1" }.arg(pid)); });
+        }
+
+        // Once a server is in a cgroup, the group knows its processes and
+        // their usage, including that of processes that have already exited.
+        std::optional<CgroupUsage> usage;
+        if (auto members = cgroupManager_ ? cgroupManager_->members(server) : std::nullopt) {
+            for (pid_t pid : std::as_const(pids)) {
+                if (!members->contains(pid)) {
+                    members->append(pid);
+                }
+            }
+            pids = *members;
+            usage = cgroupManager_->usage(server);
+        }
+
+        auto previousClientPids = server.clientPids;
+        auto previousClientProcesses = server.clientProcesses;
+        qint64 previousCpuTimeUs = server.cpuTimeUs;
+        server.setClientPids(pids);
+        if (expanded) {
+            server.sampleClientProcesses(server.sampledNs != 0 ? now - server.sampledNs : 0);
+        }
+        if (usage) {
+            server.cpuTimeUs = usage->cpuUs;
+            server.memoryBytes = usage->memoryBytes;
+        } else {
+            server.sumUsage();
+        }
+        server.peakRss = std::max(server.peakRss, server.memoryBytes);
+        if (expanded) {
+            updateClientRows(row, std::move(previousClientProcesses));
+        }
+        if (server.clientPids != previousClientPids) {
+            emit clientsChanged(server);
+        }
+        if (server.clientPids.isEmpty() != previousClientPids.isEmpty()) {
+            // Whether the server can be expanded has changed.
+            emit dataChanged(index(row, 0), index(row, 0));
+        }
+
+        if (server.sampledNs != 0 && now > server.sampledNs) {
+            double cpuTimeNs = static_cast<double>(server.cpuTimeUs - previousCpuTimeUs) * 1000.0;
+            server.cpuPercent = std::max(0.0, cpuTimeNs * 100.0 / static_cast<double>(now - server.sampledNs));
+        }
+        server.sampledNs = now;
+        emit dataChanged(index(row, 3), index(row, 4));
+
+        if (server.prewarmed && !server.prewarmUsed && server.clients > 0) {
+            server.prewarmUsed = true;
+            server.prewarmUsedMs = QDateTime::currentMSecsSinceEpoch();
+            emit dataChanged(index(row, 0), index(row, 0));
+            emit prewarmedServerUsed(server);
+        }
+    }
+}
+
+void WineServerListModel::updateClientRows(int row, QList<WineClientData> previous)
+{
+    // sampleServers() has already updated the clients; put back the ones the view
+    // knows about, so that rows can be removed and inserted one step at a
+    // time. Clients that stay come first in the sampled list, in the same
+    // order as before.
+    auto &server = listData_[row];
+    QModelIndex serverIndex = index(row, 0);
+    QList<WineClientData> sampled = std::exchange(server.clientProcesses, std::move(previous));
+    QSet<pid_t> sampledPids;
+    for (const auto &client : std::as_const(sampled)) {
+        sampledPids.insert(client.pid);
+    }
+
+    // Remove the rows of clients that exited, a run of adjacent rows at a
+    // time, from the last.
+    for (int last = static_cast<int>(server.clientProcesses.size()) - 1; last >= 0;) {
+        if (sampledPids.contains(server.clientProcesses.at(last).pid)) {
+            last--;
+            continue;
+        }
+        int first = last;
+        while (first > 0 && !sampledPids.contains(server.clientProcesses.at(first - 1).pid)) {
+            first--;
+        }
+        beginRemoveRows(serverIndex, first, last);
+        server.clientProcesses.remove(first, last - first + 1);
+        endRemoveRows();
+        last = first - 1;
+    }
+
+    int remaining = static_cast<int>(server.clientProcesses.size());
+    if (sampled.size() > remaining) {
+        beginInsertRows(serverIndex, remaining, static_cast<int>(sampled.size()) - 1);
+        server.clientProcesses = std::move(sampled);
+        endInsertRows();
+    } else {
+        server.clientProcesses = std::move(sampled);
+    }
+
+    if (remaining > 0) {
+        emit dataChanged(index(0, 3, serverIndex), index(remaining - 1, 4, serverIndex));
+    }
 }
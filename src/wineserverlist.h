@@ -1,7 +1,28 @@
 #pragma once
 
-#include <QAbstractListModel>
+#include <QAbstractItemModel>
+#include <QElapsedTimer>
+#include <QList>
+#include <QPointer>
+#include <QSet>
 #include <QString>
+#include <QTimer>
+
+class CgroupManager;
+
+/**
+ * A Wine client process of a server.
+ */
+struct WineClientData
+{
+    pid_t pid;
+
+    // The Windows executable, such as "explorer.exe".
+    QString name;
+    qint64 cpuTimeUs {};
+    qint64 memoryBytes {};
+    double cpuPercent {};
+};
 
 struct WineServerData
 {
@@ -11,28 +32,144 @@ struct WineServerData
     void kill() const;
     void taskmgr() const;
 
+    /**
+     * Sets the current client processes of the server, updating clientPids,
+     * clients and peakClients.
+     */
+    void setClientPids(const QList<pid_t> &pids);
+
+    /**
+     * Updates clientProcesses from clientPids, with the memory usage and CPU
+     * time of each client. elapsedNs is the time since the last sample, or 0
+     * if there was none. Only done for servers expanded in a view.
+     */
+    void sampleClientProcesses(qint64 elapsedNs);
+
+    /**
+     * Sets the usage totals by summing over the server and its clients.
+     */
+    void sumUsage();
+
     pid_t pid;
+
+    // The server binary, as seen from inside the server's sandbox if it is
+    // sandboxed.
     QString exe;
+    bool sandboxed {};
     QString package;
     QString prefix;
+    qint64 startedMs {};
+    qint64 peakRss {};
+    QList<pid_t> clientPids;
+    QList<WineClientData> clientProcesses;
+    int clients {};
+    int peakClients {};
+
+    // Totals over the server and its clients, from the prefix's cgroup when
+    // it has one and summed from /proc otherwise.
+    qint64 cpuTimeUs {};
+    qint64 memoryBytes {};
+    double cpuPercent {};
+    qint64 sampledNs {};
+
+    // When /proc was last scanned for the server's clients.
+    qint64 scannedNs {};
+
+    // Set for servers started ahead of time by PrewarmManager; prewarmUsed is
+    // set once a client has connected to one, at prewarmUsedMs.
+    bool prewarmed {};
+    bool prewarmUsed {};
+    qint64 prewarmUsedMs {};
 };
 
-class WineServerListModel : public QT_PREPEND_NAMESPACE(QAbstractListModel)
+/**
+ * The running wineservers, with their client processes as children. Clients
+ * are only listed once a view asks for them with fetchMore(), and are then
+ * sampled once a second instead of every ten seconds.
+ */
+class WineServerListModel : public QT_PREPEND_NAMESPACE(QAbstractItemModel)
 {
     Q_OBJECT
 
 public:
+    enum Roles : int {
+        PrewarmedRole = Qt::UserRole,
+    };
+
     WineServerListModel(QObject *parent = nullptr);
 
+    [[nodiscard]] auto index(int row, int column, const QModelIndex &parent = {}) const -> QModelIndex override;
+    [[nodiscard]] auto parent(const QModelIndex &child) const -> QModelIndex override;
     [[nodiscard]] auto rowCount(const QModelIndex &parent = {}) const -> int override;
     [[nodiscard]] auto columnCount(const QModelIndex &parent = {}) const -> int override;
+    [[nodiscard]] auto hasChildren(const QModelIndex &parent = {}) const -> bool override;
+    [[nodiscard]] auto canFetchMore(const QModelIndex &parent) const -> bool override;
+    void fetchMore(const QModelIndex &parent) override;
     [[nodiscard]] auto data(const QModelIndex &index, int role) const -> QVariant override;
     [[nodiscard]] auto headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const -> QVariant override;
     [[nodiscard]] auto server(int row) -> WineServerData &;
 
+    /**
+     * Returns the row of the server of index, which may be a server or one of
+     * its clients, or -1.
+     */
+    [[nodiscard]] auto serverRow(const QModelIndex &index) const -> int;
+
+    /**
+     * Removes the client rows of the server at parent, or of every server if
+     * parent is invalid, until they are fetched again. Called when a view
+     * collapses a server or goes away.
+     */
+    void discardChildren(const QModelIndex &parent = {});
+
+    /**
+     * Returns the row of the server with the given pid, or -1.
+     */
+    [[nodiscard]] auto rowForPid(pid_t pid) const -> int;
+
+    /**
+     * Reads usage totals from the prefix cgroups of cgroupManager, where
+     * available, instead of summing them over processes.
+     */
+    void setCgroupManager(CgroupManager *cgroupManager);
+
     Q_SLOT void serverRunning(pid_t pid);
     Q_SLOT void serverStopped(pid_t pid, bool lastServer);
 
+    /**
+     * Marks the server with the given pid as prewarmed.
+     */
+    void setPrewarmed(pid_t pid);
+
+    /**
+     * Sent when a server has stopped, just before it is removed from the
+     * model.
+     */
+    Q_SIGNAL void serverEnded(const WineServerData &server);
+
+    /**
+     * Sent the first time a prewarmed server is seen with a client.
+     */
+    Q_SIGNAL void prewarmedServerUsed(const WineServerData &server);
+
+    /**
+     * Sent when sampling finds that the set of client processes of a server
+     * has changed.
+     */
+    Q_SIGNAL void clientsChanged(const WineServerData &server);
+
 private:
+    Q_SLOT void sampleServers();
+    void updateClientRows(int row, QList<WineClientData> previous);
+    void updateSampleInterval();
+    [[nodiscard]] static auto isServer(const QModelIndex &index) -> bool;
+    [[nodiscard]] auto clientData(const QModelIndex &index, int role) const -> QVariant;
+
     QList<WineServerData> listData_;
+
+    // Servers whose clients have been fetched, by pid.
+    QSet<pid_t> fetched_;
+    QTimer sampleTimer_;
+    QElapsedTimer clock_;
+    QPointer<CgroupManager> cgroupManager_;
 };
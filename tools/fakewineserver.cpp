@@ -0,0 +1,263 @@
+// A stand-in for wineserver that only implements what Winemon observes: the
+// per-server directory, the lock file and a listening UNIX socket. It is used
+// by winemon-bench to start and stop large numbers of "servers" cheaply.
+//
+// Usage: fake-wineserver [--root DIR] [--name NAME] [--sandbox] [--listen-delay MS]
+//
+// With --sandbox, the server first moves into a user and mount namespace of
+// its own with a private /tmp, like a Flatpak sandbox, so that it can only be
+// found through /proc/<pid>/root. It exits with status 3 if that fails.
+//
+// With --listen-delay, the server waits that long between binding its socket
+// and listening on it, during which connections are refused.
+//
+// The server exits cleanly (removing its socket, like wineserver does) on
+// SIGTERM, SIGINT or an "exit" line on stdin. On SIGUSR1 or a "crash" line it
+// exits without cleaning up, leaving a stale socket behind.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <array>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace {
+
+enum class ExitMode : int { None = 0, Clean, Crash };
+
+int signalPipe[2] = { -1, -1 }; // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+void handleSignal(int signal)
+{
+    char mode = signal == SIGUSR1 ? static_cast<char>(ExitMode::Crash) : static_cast<char>(ExitMode::Clean);
+    auto result = write(signalPipe[1], &mode, 1);
+    (void)result;
+}
+
+auto ensureDirectory(const std::string &path) -> bool
+{
+    if (mkdir(path.c_str(), S_IRWXU) == 0 || errno == EEXIST) {
+        return true;
+    }
+    fprintf(stderr, "fake-wineserver: unable to create %s (errno=%d)\n", path.c_str(), errno);
+    return false;
+}
+
+auto lockServerDirectory(const std::string &lockPath) -> int
+{
+    // wineserver holds a write lock on <serverdir>/lock for its lifetime.
+    int fd = open(lockPath.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        fprintf(stderr, "fake-wineserver: unable to open %s (errno=%d)\n", lockPath.c_str(), errno);
+        return -1;
+    }
+
+    struct flock fl = {};
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    if (fcntl(fd, F_SETLK, &fl) == -1) {
+        fprintf(stderr, "fake-wineserver: %s is locked by another server\n", lockPath.c_str());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+auto listenOnSocket(const std::string &socketPath, int listenDelayMs) -> int
+{
+    struct sockaddr_un addr = {};
+    if (socketPath.size() > sizeof(addr.sun_path) - 1) {
+        fprintf(stderr, "fake-wineserver: path is too long for UNIX socket: %s\n", socketPath.c_str());
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock == -1) {
+        fprintf(stderr, "fake-wineserver: unable to create UNIX socket (errno=%d)\n", errno);
+        return -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strncpy(static_cast<char *>(addr.sun_path), socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    // We hold the lock, so any existing socket is stale.
+    unlink(socketPath.c_str());
+    if (bind(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1) { // NOLINT
+        fprintf(stderr, "fake-wineserver: unable to bind %s (errno=%d)\n", socketPath.c_str(), errno);
+        close(sock);
+        return -1;
+    }
+    if (listenDelayMs > 0) {
+        usleep(static_cast<useconds_t>(listenDelayMs) * 1000);
+    }
+    if (listen(sock, SOMAXCONN) == -1) {
+        fprintf(stderr, "fake-wineserver: unable to listen on %s (errno=%d)\n", socketPath.c_str(), errno);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+auto writeFile(const char *path, const std::string &value) -> bool
+{
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+    close(fd);
+    return ok;
+}
+
+auto enterSandbox() -> bool
+{
+    // A user namespace lets an unprivileged process create a mount
+    // namespace; mapping our own ids keeps files owned by us.
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+    if (unshare(CLONE_NEWUSER | CLONE_NEWNS) == -1) {
+        fprintf(stderr, "fake-wineserver: unable to create namespaces (errno=%d)\n", errno);
+        return false;
+    }
+    if (!writeFile("/proc/self/setgroups", "deny")
+        || !writeFile("/proc/self/uid_map", std::to_string(uid) + " " + std::to_string(uid) + " 1")
+        || !writeFile("/proc/self/gid_map", std::to_string(gid) + " " + std::to_string(gid) + " 1")) {
+        fprintf(stderr, "fake-wineserver: unable to map ids (errno=%d)\n", errno);
+        return false;
+    }
+    if (mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) == -1
+        || mount("tmpfs", "/tmp", "tmpfs", MS_NOSUID | MS_NODEV, "mode=1777") == -1) {
+        fprintf(stderr, "fake-wineserver: unable to mount a private /tmp (errno=%d)\n", errno);
+        return false;
+    }
+    return true;
+}
+
+auto readCommand(int fd, bool &eof) -> ExitMode
+{
+    std::array<char, 256> buffer {};
+    ssize_t size = read(fd, buffer.data(), buffer.size());
+    if (size <= 0) {
+        eof = size == 0 || errno != EINTR;
+        return ExitMode::None;
+    }
+    std::string_view command { buffer.data(), static_cast<size_t>(size) };
+    if (command.find("crash") != std::string_view::npos) {
+        return ExitMode::Crash;
+    }
+    if (command.find("exit") != std::string_view::npos) {
+        return ExitMode::Clean;
+    }
+    return ExitMode::None;
+}
+
+}
+
+auto main(int argc, char *argv[]) -> int
+{
+    std::string root = "/tmp/.wine-" + std::to_string(getuid());
+    std::string name = "server-fake-" + std::to_string(getpid());
+    bool sandbox = false;
+    int listenDelayMs = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg { argv[i] }; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        if (arg == "--root" && i + 1 < argc) {
+            root = argv[++i]; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        } else if (arg == "--name" && i + 1 < argc) {
+            name = argv[++i]; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        } else if (arg == "--sandbox") {
+            sandbox = true;
+        } else if (arg == "--listen-delay" && i + 1 < argc) {
+            listenDelayMs = atoi(argv[++i]); // NOLINT
+        } else {
+            fprintf(stderr, "Usage: %s [--root DIR] [--name NAME] [--sandbox] [--listen-delay MS]\n", argv[0]); // NOLINT
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (sandbox && !enterSandbox()) {
+        return 3;
+    }
+
+    std::string serverDir = root + "/" + name;
+    std::string socketPath = serverDir + "/socket";
+    if (!ensureDirectory(root) || !ensureDirectory(serverDir)) {
+        return EXIT_FAILURE;
+    }
+
+    int lockFd = lockServerDirectory(serverDir + "/lock");
+    if (lockFd == -1) {
+        return 2;
+    }
+
+    if (pipe2(static_cast<int *>(signalPipe), O_CLOEXEC | O_NONBLOCK) == -1) {
+        return EXIT_FAILURE;
+    }
+    struct sigaction action = {};
+    action.sa_handler = handleSignal;
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGUSR1, &action, nullptr);
+
+    int sock = listenOnSocket(socketPath, listenDelayMs);
+    if (sock == -1) {
+        return EXIT_FAILURE;
+    }
+
+    bool haveStdin = true;
+    ExitMode mode = ExitMode::None;
+    while (mode == ExitMode::None) {
+        std::array<struct pollfd, 3> fds = { {
+                { .fd = sock, .events = POLLIN, .revents = 0 },
+                { .fd = signalPipe[0], .events = POLLIN, .revents = 0 },
+                { .fd = haveStdin ? STDIN_FILENO : -1, .events = POLLIN, .revents = 0 },
+        } };
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if ((fds[0].revents & POLLIN) != 0) {
+            // Accept and immediately drop; Winemon only needs SO_PEERCRED.
+            int client = -1;
+            while ((client = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC)) != -1) {
+                close(client);
+            }
+        }
+        if ((fds[1].revents & POLLIN) != 0) {
+            char signalMode = 0;
+            if (read(signalPipe[0], &signalMode, 1) == 1) {
+                mode = static_cast<ExitMode>(signalMode);
+            }
+        }
+        if ((fds[2].revents & (POLLIN | POLLHUP)) != 0) {
+            // EOF on stdin just stops us from listening for commands.
+            bool eof = false;
+            mode = readCommand(STDIN_FILENO, eof);
+            haveStdin = !eof;
+        }
+    }
+
+    if (mode == ExitMode::Crash) {
+        _exit(EXIT_FAILURE);
+    }
+
+    unlink(socketPath.c_str());
+    close(sock);
+    close(lockFd);
+    return EXIT_SUCCESS;
+}
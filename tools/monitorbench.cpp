@@ -0,0 +1,916 @@
+// Drives WineMonitorLinux headlessly against fake-wineserver processes and
+// reports missed/duplicate events and signal latency. See README.md.
+
+#include <fcntl.h>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/mount.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QList>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QTextStream>
+#include <QThread>
+
+#include "../src/cgroupmanager.h"
+#include "../src/sessionhistory.h"
+#include "../src/winemonitor_linux.h"
+#include "../src/wineserverlist.h"
+
+QT_USE_NAMESPACE
+
+extern char **environ; // NOLINT(readability-redundant-declaration)
+
+namespace {
+
+constexpr int kEventTimeoutMs = 10000;
+
+// How often waitFor() checks its condition. Some conditions, such as a socket
+// appearing in a sandbox, do not come with an event to wake up for.
+constexpr int kPollIntervalMs = 10;
+
+// Exit status for tests that cannot run here, which CTest reports as skipped.
+constexpr int kSkippedExitCode = 77;
+
+struct Lifetime
+{
+    pid_t pid {};
+    qint64 spawnedNs {};
+    qint64 stopRequestedNs = -1;
+    qint64 runningNs = -1;
+    qint64 stoppedNs = -1;
+    bool reaped = false;
+};
+
+struct ScenarioStats
+{
+    QString name;
+    int servers {};
+    int missedStarts {};
+    int missedStops {};
+    int duplicates {};
+    QList<qint64> startLatencyNs;
+    QList<qint64> stopLatencyNs;
+    QString note;
+    bool skipped {};
+
+    // Checks that failed beyond missed and duplicate events.
+    QStringList failures;
+};
+
+auto percentileMs(QList<qint64> values, double percentile) -> double
+{
+    if (values.isEmpty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    auto index = std::min(values.size() - 1, static_cast<qsizetype>(static_cast<double>(values.size()) * percentile));
+    return static_cast<double>(values.at(index)) / 1e6;
+}
+
+void raiseFileLimit()
+{
+    struct rlimit limit = {};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+auto createStaleSocket(const QString &serverDir) -> bool
+{
+    QDir {}.mkpath(serverDir);
+    QByteArray socketPath = QDir { serverDir }.absoluteFilePath("socket").toUtf8();
+
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(static_cast<char *>(addr.sun_path), socketPath.constData(), sizeof(addr.sun_path) - 1);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1) {
+        return false;
+    }
+    unlink(socketPath.constData());
+    bool ok = bind(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0; // NOLINT
+    ok = ok && listen(sock, 1) == 0;
+
+    // Closing without unlinking leaves a socket that refuses connections.
+    close(sock);
+    return ok;
+}
+
+// Backdates a directory so that the monitor considers it old enough to
+// collect.
+void ageDirectory(const QString &path)
+{
+    static constexpr time_t kDaySeconds = 24 * 60 * 60;
+    std::array<struct timespec, 2> times {};
+    times[0].tv_sec = times[1].tv_sec = time(nullptr) - kDaySeconds;
+    utimensat(AT_FDCWD, QFile::encodeName(path).constData(), times.data(), 0);
+}
+
+auto timeMonitorStart(const QString &root, const QString &indexPath, qint64 &probes) -> double
+{
+    WineMonitorLinux monitor { root, indexPath };
+    QElapsedTimer startTimer;
+    startTimer.start();
+    monitor.start();
+    probes = monitor.probeCount();
+    return static_cast<double>(startTimer.nsecsElapsed()) / 1e6;
+}
+
+auto canReusePids() -> bool
+{
+    return access("/proc/sys/kernel/ns_last_pid", W_OK) == 0;
+}
+
+// Checks whether fake-wineserver --sandbox can work, by trying the same
+// unshare and mount in a child process.
+auto canSandbox() -> bool
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        bool ok = unshare(CLONE_NEWUSER | CLONE_NEWNS) == 0
+                && mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) == 0
+                && mount("tmpfs", "/tmp", "tmpfs", 0, nullptr) == 0;
+        _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    int status = 0;
+    return pid != -1 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+auto setLastPid(pid_t pid) -> bool
+{
+    QFile lastPid { "/proc/sys/kernel/ns_last_pid" };
+    if (!lastPid.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    return lastPid.write(QByteArray::number(pid)) > 0;
+}
+
+class MonitorBench
+{
+public:
+    MonitorBench(QString fakeServerPath, QString root)
+        : fakeServerPath_ { std::move(fakeServerPath) }
+        , root_ { std::move(root) }
+    {
+    }
+
+    /**
+     * Starts fake servers in sandboxes of their own, in their own /tmp
+     * rather than under root.
+     */
+    void setSandboxed(bool sandboxed)
+    {
+        sandboxed_ = sandboxed;
+    }
+
+    /**
+     * Makes fake servers refuse connections for this long after creating
+     * their socket, like a wineserver that has not called listen() yet.
+     */
+    void setListenDelay(int listenDelayMs)
+    {
+        listenDelayMs_ = listenDelayMs;
+    }
+
+    void attach(WineMonitor *monitor)
+    {
+        QObject::connect(monitor, &WineMonitor::serverRunning, monitor, [this](pid_t pid) { serverRunning(pid); });
+        QObject::connect(monitor, &WineMonitor::serverStopped, monitor, [this](pid_t pid, bool) { serverStopped(pid); });
+    }
+
+    void begin(ScenarioStats *stats)
+    {
+        stats_ = stats;
+        clock_.start();
+    }
+
+    auto spawn(const QString &name) -> Lifetime *
+    {
+        QByteArray program = fakeServerPath_.toUtf8();
+        QByteArrayList args = { program };
+        if (sandboxed_) {
+            args << "--sandbox";
+        } else {
+            args << "--root" << root_.toUtf8();
+        }
+        args << "--name" << name.toUtf8();
+        if (listenDelayMs_ > 0) {
+            args << "--listen-delay" << QByteArray::number(listenDelayMs_);
+        }
+        std::vector<char *> argv;
+        for (auto &arg : args) {
+            argv.push_back(arg.data());
+        }
+        argv.push_back(nullptr);
+
+        posix_spawn_file_actions_t actions {};
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+        pid_t pid = -1;
+        qint64 spawnedNs = clock_.nsecsElapsed();
+        int result = posix_spawn(&pid, program.constData(), &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        if (result != 0) {
+            qWarning("Unable to spawn %s (error=%d)", program.constData(), result);
+            return nullptr;
+        }
+
+        auto *lifetime = new Lifetime { .pid = pid, .spawnedNs = spawnedNs };
+        lifetimes_[pid].append(lifetime);
+        stats_->servers++;
+        return lifetime;
+    }
+
+    void stop(Lifetime *lifetime, int signal = SIGTERM)
+    {
+        lifetime->stopRequestedNs = clock_.nsecsElapsed();
+        ::kill(lifetime->pid, signal);
+    }
+
+    auto waitFor(const std::function<bool()> &done, int timeoutMs = kEventTimeoutMs) -> bool
+    {
+        QElapsedTimer timer;
+        timer.start();
+        while (!done()) {
+            if (timer.elapsed() > timeoutMs) {
+                return false;
+            }
+            QTest::qWait(kPollIntervalMs);
+        }
+        return true;
+    }
+
+    auto waitRunning(const QList<Lifetime *> &servers) -> bool
+    {
+        return waitFor([&] {
+            return std::all_of(servers.begin(), servers.end(), [](auto *lt) { return lt->runningNs >= 0; });
+        });
+    }
+
+    auto waitStopped(const QList<Lifetime *> &servers) -> bool
+    {
+        return waitFor([&] {
+            return std::all_of(servers.begin(), servers.end(), [](auto *lt) { return lt->stoppedNs >= 0; });
+        });
+    }
+
+    /**
+     * Accounts for and frees every lifetime, counting events that never
+     * arrived as missed. Reaps the processes.
+     */
+    void finish()
+    {
+        for (const auto &queue : lifetimes_) {
+            for (auto *lifetime : queue) {
+                if (lifetime->runningNs < 0) {
+                    stats_->missedStarts++;
+                }
+                if (lifetime->stopRequestedNs >= 0 && lifetime->stoppedNs < 0) {
+                    stats_->missedStops++;
+                }
+                if (lifetime->stopRequestedNs < 0 && !lifetime->reaped) {
+                    ::kill(lifetime->pid, SIGKILL);
+                }
+            }
+        }
+        for (const auto &queue : lifetimes_) {
+            for (auto *lifetime : queue) {
+                reap(lifetime);
+                delete lifetime; // NOLINT
+            }
+        }
+        lifetimes_.clear();
+    }
+
+    /**
+     * Forgets lifetimes whose events have all been observed, so that their
+     * pids can be reused without confusing the bookkeeping.
+     */
+    void retire()
+    {
+        for (auto &queue : lifetimes_) {
+            queue.removeIf([](Lifetime *lifetime) {
+                if (lifetime->runningNs >= 0 && lifetime->stoppedNs >= 0) {
+                    reap(lifetime);
+                    delete lifetime; // NOLINT
+                    return true;
+                }
+                return false;
+            });
+        }
+        for (auto it = lifetimes_.begin(); it != lifetimes_.end();) {
+            it = it->isEmpty() ? lifetimes_.erase(it) : std::next(it);
+        }
+    }
+
+    static void reap(Lifetime *lifetime)
+    {
+        if (!lifetime->reaped) {
+            waitpid(lifetime->pid, nullptr, 0);
+            lifetime->reaped = true;
+        }
+    }
+
+private:
+    void serverRunning(pid_t pid)
+    {
+        for (auto *lifetime : lifetimes_.value(pid)) {
+            if (lifetime->runningNs < 0) {
+                lifetime->runningNs = clock_.nsecsElapsed();
+                stats_->startLatencyNs.append(lifetime->runningNs - lifetime->spawnedNs);
+                return;
+            }
+        }
+        stats_->duplicates++;
+    }
+
+    void serverStopped(pid_t pid)
+    {
+        for (auto *lifetime : lifetimes_.value(pid)) {
+            if (lifetime->stoppedNs < 0) {
+                lifetime->stoppedNs = clock_.nsecsElapsed();
+                if (lifetime->stopRequestedNs >= 0) {
+                    stats_->stopLatencyNs.append(lifetime->stoppedNs - lifetime->stopRequestedNs);
+                }
+                return;
+            }
+        }
+        stats_->duplicates++;
+    }
+
+    QString fakeServerPath_;
+    QString root_;
+    bool sandboxed_ {};
+    int listenDelayMs_ {};
+    QElapsedTimer clock_;
+    ScenarioStats *stats_ = nullptr;
+    QHash<pid_t, QList<Lifetime *>> lifetimes_;
+};
+
+void runWaves(MonitorBench &bench, int waves, int waveSize, const QString &namePrefix, int crashEvery = 0)
+{
+    for (int wave = 0; wave < waves; wave++) {
+        QList<Lifetime *> servers;
+        for (int slot = 0; slot < waveSize; slot++) {
+            if (auto *lifetime = bench.spawn(QString { "%1-%2" }.arg(namePrefix).arg(slot))) {
+                servers.append(lifetime);
+            }
+        }
+        bench.waitRunning(servers);
+        for (int i = 0; i < servers.size(); i++) {
+            bool crash = crashEvery > 0 && i % crashEvery == 0;
+            bench.stop(servers.at(i), crash ? SIGUSR1 : SIGTERM);
+        }
+        bench.waitStopped(servers);
+        bench.retire();
+    }
+}
+
+auto scenarioWaves(const QString &fakeServer, int waves, int waveSize) -> ScenarioStats
+{
+    ScenarioStats stats { .name = "waves" };
+    QTemporaryDir root;
+    MonitorBench bench { fakeServer, root.path() };
+    WineMonitorLinux monitor { root.path() };
+    bench.attach(&monitor);
+    bench.begin(&stats);
+    monitor.start();
+
+    runWaves(bench, waves, waveSize, "server-bench");
+    bench.finish();
+    return stats;
+}
+
+auto scenarioStale(const QString &fakeServer, int staleCount, int waveSize) -> ScenarioStats
+{
+    ScenarioStats stats { .name = "stale" };
+    QTemporaryDir root;
+    QTemporaryDir cache;
+    QString indexPath = cache.filePath("probe-index");
+
+    // Half of the stale directories are old enough to be removed; the other
+    // half are too recent and end up in the probe index instead.
+    for (int i = 0; i < staleCount; i++) {
+        QString serverDir = QString { "%1/server-stale-%2" }.arg(root.path()).arg(i);
+        createStaleSocket(serverDir);
+        if (i % 2 == 0) {
+            ageDirectory(serverDir);
+        }
+    }
+
+    // Aged directories that are not wineserver directories must be left
+    // alone: one without the server- name, and a server- symlink to one
+    // outside the root.
+    QString otherDir = root.filePath("other");
+    QString linkTarget = cache.filePath("target");
+    createStaleSocket(otherDir);
+    createStaleSocket(linkTarget);
+    ageDirectory(otherDir);
+    ageDirectory(linkTarget);
+    QFile::link(linkTarget, root.filePath("server-link"));
+
+    qint64 coldProbes = 0;
+    qint64 warmProbes = 0;
+    double coldMs = timeMonitorStart(root.path(), indexPath, coldProbes);
+    double warmMs = timeMonitorStart(root.path(), indexPath, warmProbes);
+    auto remaining = QDir { root.path() }.entryList({ "server-stale-*" }, QDir::Dirs | QDir::NoDotAndDotDot).size();
+    if (auto aged = (staleCount + 1) / 2; staleCount - remaining != aged) {
+        stats.failures.append(QString { "removed %1 of %2 aged directories" }.arg(staleCount - remaining).arg(aged));
+    }
+    if (!QFileInfo::exists(otherDir + "/socket") || !QFileInfo::exists(linkTarget + "/socket")) {
+        stats.failures.append("removed a directory that is not a wineserver directory");
+    }
+    if (warmProbes != 0) {
+        stats.failures.append(QString { "%1 probes despite the probe index" }.arg(warmProbes));
+    }
+    stats.note = QString { "start() with %1 stale entries took %2 ms with %3 probes, then %4 ms with %5 probes "
+                           "using the probe index; %6 directories removed" }
+                         .arg(staleCount)
+                         .arg(coldMs, 0, 'f', 2)
+                         .arg(coldProbes)
+                         .arg(warmMs, 0, 'f', 2)
+                         .arg(warmProbes)
+                         .arg(staleCount - remaining);
+
+    MonitorBench bench { fakeServer, root.path() };
+    WineMonitorLinux monitor { root.path(), indexPath };
+    bench.attach(&monitor);
+    bench.begin(&stats);
+    monitor.start();
+
+    // Start servers on top of the stale sockets, crash every other one so it
+    // leaves a stale socket behind, then do it again in the same directories.
+    runWaves(bench, 2, std::min(waveSize, staleCount), "server-stale", 2);
+    bench.finish();
+    return stats;
+}
+
+auto scenarioSlowListen(const QString &fakeServer, int waveSize) -> ScenarioStats
+{
+    // Every server is probed while it refuses connections. A server taken
+    // for dead would not be probed again, and its start would be missed.
+    static constexpr int kListenDelayMs = 300;
+    ScenarioStats stats { .name = "slow-listen" };
+    QTemporaryDir root;
+    QTemporaryDir cache;
+    QString indexPath = cache.filePath("probe-index");
+    MonitorBench bench { fakeServer, root.path() };
+    bench.setListenDelay(kListenDelayMs);
+    WineMonitorLinux monitor { root.path(), indexPath };
+    bench.attach(&monitor);
+    bench.begin(&stats);
+    monitor.start();
+
+    runWaves(bench, 1, waveSize, "server-slow");
+    bench.finish();
+    return stats;
+}
+
+auto scenarioSandboxes(const QString &fakeServer, int sandboxCount) -> ScenarioStats
+{
+    ScenarioStats stats { .name = "sandboxes" };
+    if (!canSandbox()) {
+        stats.note = "skipped: unable to create user and mount namespaces";
+        stats.skipped = true;
+        return stats;
+    }
+
+    QTemporaryDir root;
+    MonitorBench bench { fakeServer, root.path() };
+    bench.setSandboxed(true);
+    WineMonitorLinux monitor { root.path() };
+    monitor.setNamespaceDiscovery(true);
+    bench.attach(&monitor);
+    bench.begin(&stats);
+    monitor.start();
+    qsizetype existingNamespaces = monitor.namespaceCount();
+
+    // Wait for every sandbox to be listening before looking for them, as a
+    // change to $XDG_RUNTIME_DIR/.flatpak would trigger a sweep.
+    QList<Lifetime *> servers;
+    for (int i = 0; i < sandboxCount; i++) {
+        if (auto *lifetime = bench.spawn(QString { "server-sandbox-%1" }.arg(i))) {
+            servers.append(lifetime);
+        }
+    }
+    QString socketFormat = QString { "/proc/%1/root/tmp/.wine-%2/server-sandbox-%3/socket" };
+    bench.waitFor([&] {
+        for (int i = 0; i < servers.size(); i++) {
+            if (!QFileInfo::exists(socketFormat.arg(servers.at(i)->pid).arg(getuid()).arg(i))) {
+                return false;
+            }
+        }
+        return true;
+    });
+
+    QElapsedTimer sweepTimer;
+    sweepTimer.start();
+    monitor.discoverNamespaces();
+    double sweepMs = static_cast<double>(sweepTimer.nsecsElapsed()) / 1e6;
+    qsizetype found = monitor.namespaceCount() - existingNamespaces;
+    sweepTimer.restart();
+    monitor.discoverNamespaces();
+    double idleSweepMs = static_cast<double>(sweepTimer.nsecsElapsed()) / 1e6;
+    bench.waitRunning(servers);
+
+    for (auto *lifetime : servers) {
+        bench.stop(lifetime);
+    }
+    bench.waitStopped(servers);
+    bench.waitFor([&] { return monitor.namespaceCount() == existingNamespaces; });
+    if (found != servers.size()) {
+        stats.failures.append(QString { "found %1 of %2 namespaces" }.arg(found).arg(servers.size()));
+    }
+    if (monitor.namespaceCount() != existingNamespaces) {
+        stats.failures.append("namespaces still watched after the sandboxes exited");
+    }
+    stats.note = QString { "found %1 of %2 namespaces in a %3 ms sweep of /proc (%4 ms once known); "
+                           "%5 left watched after the sandboxes exited" }
+                         .arg(found)
+                         .arg(servers.size())
+                         .arg(sweepMs, 0, 'f', 2)
+                         .arg(idleSweepMs, 0, 'f', 2)
+                         .arg(monitor.namespaceCount() - existingNamespaces);
+    bench.finish();
+    return stats;
+}
+
+auto scenarioPidReuse(const QString &fakeServer, int rounds) -> ScenarioStats
+{
+    ScenarioStats stats { .name = "pid-reuse" };
+    if (!canReusePids()) {
+        stats.note = "skipped: /proc/sys/kernel/ns_last_pid is not writable";
+        stats.skipped = true;
+        return stats;
+    }
+
+    QTemporaryDir root;
+    MonitorBench bench { fakeServer, root.path() };
+    WineMonitorLinux monitor { root.path() };
+    bench.attach(&monitor);
+    bench.begin(&stats);
+    monitor.start();
+
+    int reused = 0;
+    for (int round = 0; round < rounds; round++) {
+        auto *first = bench.spawn("server-reuse");
+        if (first == nullptr || !bench.waitRunning({ first })) {
+            continue;
+        }
+
+        // Reap immediately so that the pid is free before the monitor has
+        // necessarily noticed that the first server stopped.
+        bench.stop(first);
+        MonitorBench::reap(first);
+        setLastPid(first->pid - 1);
+        auto *second = bench.spawn("server-reuse");
+        if (second == nullptr) {
+            continue;
+        }
+        if (second->pid == first->pid) {
+            reused++;
+        }
+
+        bench.waitStopped({ first });
+        bench.waitRunning({ second });
+        bench.stop(second);
+        bench.waitStopped({ second });
+        bench.retire();
+    }
+    bench.finish();
+    stats.note = QString { "%1 of %2 rounds reused the pid" }.arg(reused).arg(rounds);
+    return stats;
+}
+
+auto writeFile(const QString &path, const QByteArray &contents) -> bool
+{
+    QFile file { path };
+    return file.open(QIODevice::WriteOnly) && file.write(contents) == contents.size();
+}
+
+/**
+ * Runs CgroupManager against a fake cgroupfs in a temporary directory, with
+ * this process standing in for a wineserver: checks that it is moved into a
+ * group of its own, that limits are written, and that usage and membership
+ * are read back from the group's files.
+ */
+auto scenarioCgroup() -> ScenarioStats
+{
+    ScenarioStats stats { .name = "cgroup" };
+    QTemporaryDir root;
+    QTemporaryDir config;
+
+    // Keep the settings CgroupManager saves away from the real ones.
+    QSettings::setPath(QSettings::NativeFormat, QSettings::UserScope, config.path());
+
+    WineServerListModel listModel;
+    CgroupManager cgroupManager { root.filePath("winemon"), &listModel };
+    listModel.setCgroupManager(&cgroupManager);
+    pid_t pid = getpid();
+    listModel.serverRunning(pid);
+    const auto &server = listModel.server(listModel.rowForPid(pid));
+    cgroupManager.setEnabled(true);
+
+    // The only group under the root is the one for our prefix.
+    QDir rootDir { root.filePath("winemon") };
+    QStringList groups = rootDir.entryList({ "prefix-*" }, QDir::Dirs | QDir::NoDotAndDotDot);
+    if (groups.size() != 1) {
+        stats.failures.append(QString { "expected one prefix group, found %1" }.arg(groups.size()));
+        return stats;
+    }
+    QString group = rootDir.absoluteFilePath(groups.first());
+    stats.servers = 1;
+
+    QFile procs { group + "/cgroup.procs" };
+    if (!procs.open(QIODevice::ReadOnly) || procs.readAll().trimmed() != QByteArray::number(pid)) {
+        stats.failures.append("the server was not written to cgroup.procs");
+    }
+    procs.close();
+
+    cgroupManager.setLimits(server.prefix, { { "memoryHigh", 1 << 30 }, { "cpuWeight", 50 } });
+    QFile memoryHigh { group + "/memory.high" };
+    QFile cpuWeight { group + "/cpu.weight" };
+    if (!memoryHigh.open(QIODevice::ReadOnly) || !memoryHigh.readAll().endsWith(QByteArray::number(1 << 30))
+            || !cpuWeight.open(QIODevice::ReadOnly) || !cpuWeight.readAll().endsWith("50")) {
+        stats.failures.append("limits were not written to memory.high and cpu.weight");
+    }
+
+    // Fill in the files the kernel would, including a child of the server.
+    static constexpr pid_t kChildPid = 4194304;
+    writeFile(group + "/cgroup.procs", QByteArray::number(pid) + '\n' + QByteArray::number(kChildPid) + '\n');
+    writeFile(group + "/cpu.stat", "usage_usec 1500000\nuser_usec 1000000\nsystem_usec 500000\n");
+    writeFile(group + "/memory.current", "268435456\n");
+    writeFile(group + "/io.stat", "8:0 rbytes=4096 wbytes=8192 rios=1 wios=2\n8:16 rbytes=1024 wbytes=0\n");
+    writeFile(group + "/memory.events", "low 0\nhigh 3\nmax 0\noom 0\noom_kill 1\n");
+
+    auto usage = cgroupManager.usage(server);
+    if (!usage) {
+        stats.failures.append("usage could not be read");
+    } else if (usage->cpuUs != 1500000 || usage->memoryBytes != 268435456 || usage->ioReadBytes != 5120
+            || usage->ioWriteBytes != 8192 || usage->memoryHighEvents != 3 || usage->oomKills != 1) {
+        stats.failures.append("usage does not match the group's files");
+    }
+    auto members = cgroupManager.members(server);
+    if (!members || *members != QList<pid_t> { kChildPid }) {
+        stats.failures.append("members do not match cgroup.procs");
+    }
+
+    listModel.serverStopped(pid, true);
+    if (cgroupManager.usage(WineServerData { pid })) {
+        stats.failures.append("usage is still read after the server stopped");
+    }
+    return stats;
+}
+
+/**
+ * Fills a session history with records spread over the last year, and times
+ * usage queries over the last week and the whole year. Returns false if the
+ * records were not all written, or if a query returned the wrong prefixes or
+ * took longer than maxQueryMs.
+ */
+auto benchmarkHistory(int recordCount, double maxQueryMs) -> bool
+{
+    // Appends are written on a background thread; this is far longer than a
+    // million of them take.
+    static constexpr int kAppendTimeoutMs = 60 * 1000;
+    static constexpr qint64 kDayMs = 24LL * 60 * 60 * 1000;
+    static constexpr qint64 kYearMs = 365 * kDayMs;
+    static constexpr int kPrefixes = 20;
+
+    QTemporaryDir directory;
+    SessionHistory history { directory.path() };
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 spacingMs = kYearMs / std::max(recordCount, 1);
+    QStringList prefixes;
+    for (int i = 0; i < kPrefixes; i++) {
+        prefixes.append(QString { "/home/user/prefix-%1" }.arg(i));
+    }
+    QString version { "wine-9.0" };
+    QString exe { "/usr/bin/wineserver" };
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < recordCount; i++) {
+        SessionRecord record = {};
+        record.stopMs = now - kYearMs + i * spacingMs;
+        record.startMs = record.stopMs - spacingMs / 2;
+        history.append(record, prefixes.at(i % kPrefixes), version, exe);
+    }
+    while (history.size() < recordCount && timer.elapsed() < kAppendTimeoutMs) {
+        QThread::msleep(1);
+    }
+    double appendMs = static_cast<double>(timer.nsecsElapsed()) / 1e6;
+    QTextStream out { stdout };
+    if (history.size() < recordCount) {
+        out << QString::asprintf("history: FAILED: only %lld of %d records were written\n",
+                static_cast<long long>(history.size()),
+                recordCount);
+        return false;
+    }
+
+    timer.restart();
+    auto week = history.usageByPrefix(now - 7 * kDayMs, now);
+    double weekMs = static_cast<double>(timer.nsecsElapsed()) / 1e6;
+
+    timer.restart();
+    auto year = history.usageByPrefix(now - kYearMs, now);
+    double yearMs = static_cast<double>(timer.nsecsElapsed()) / 1e6;
+
+    out << QString::asprintf("history: appended %d records in %.1f ms; week query %.2f ms (%lld prefixes), "
+                             "year query %.2f ms (%lld prefixes)\n",
+            recordCount,
+            appendMs,
+            weekMs,
+            static_cast<long long>(week.size()),
+            yearMs,
+            static_cast<long long>(year.size()));
+
+    QStringList failures;
+    if (year.size() != std::min(recordCount, kPrefixes)) {
+        failures.append(QString { "the year query found %1 prefixes" }.arg(year.size()));
+    }
+    if (maxQueryMs > 0 && std::max(weekMs, yearMs) > maxQueryMs) {
+        failures.append(QString { "a query took %1 ms" }.arg(std::max(weekMs, yearMs), 0, 'f', 2));
+    }
+    for (const auto &failure : failures) {
+        out << "history: FAILED: " << failure << "\n";
+    }
+    return failures.isEmpty();
+}
+
+/**
+ * Fails a scenario if any server took longer than maxLatencyMs to be reported
+ * as started or stopped.
+ */
+void checkLatency(ScenarioStats &stats, double maxLatencyMs)
+{
+    if (maxLatencyMs <= 0) {
+        return;
+    }
+    if (double worstMs = percentileMs(stats.startLatencyNs, 1.0); worstMs > maxLatencyMs) {
+        stats.failures.append(QString { "a start took %1 ms to be signalled" }.arg(worstMs, 0, 'f', 2));
+    }
+    if (double worstMs = percentileMs(stats.stopLatencyNs, 1.0); worstMs > maxLatencyMs) {
+        stats.failures.append(QString { "an exit took %1 ms to be signalled" }.arg(worstMs, 0, 'f', 2));
+    }
+}
+
+void report(const QList<ScenarioStats> &results)
+{
+    QTextStream out { stdout };
+    out << QString::asprintf("%-10s %8s %10s %10s %10s %10s %10s %10s %10s\n",
+            "scenario",
+            "servers",
+            "start-p50",
+            "start-p99",
+            "stop-p50",
+            "stop-p99",
+            "miss-start",
+            "miss-stop",
+            "duplicate");
+    for (const auto &stats : results) {
+        out << QString::asprintf("%-10s %8d %10.2f %10.2f %10.2f %10.2f %10d %10d %10d\n",
+                qPrintable(stats.name),
+                stats.servers,
+                percentileMs(stats.startLatencyNs, 0.50),
+                percentileMs(stats.startLatencyNs, 0.99),
+                percentileMs(stats.stopLatencyNs, 0.50),
+                percentileMs(stats.stopLatencyNs, 0.99),
+                stats.missedStarts,
+                stats.missedStops,
+                stats.duplicates);
+    }
+    out << "(latencies in ms)\n";
+    for (const auto &stats : results) {
+        if (!stats.note.isEmpty()) {
+            out << stats.name << ": " << stats.note << "\n";
+        }
+        for (const auto &failure : stats.failures) {
+            out << stats.name << ": FAILED: " << failure << "\n";
+        }
+    }
+}
+
+}
+
+auto main(int argc, char *argv[]) -> int
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Stress and latency benchmark for the wineserver monitor.");
+    parser.addHelpOption();
+    QCommandLineOption fakeServerOption { "fake-wineserver", "Path to the fake-wineserver helper.", "path" };
+    QCommandLineOption scenarioOption { "scenario",
+        "Scenario to run: waves, stale, slow-listen, sandboxes, pid-reuse, cgroup or history. May be repeated; "
+        "all run by default.",
+        "name" };
+    QCommandLineOption maxLatencyOption {
+        "max-latency-ms", "Fail if a start or exit takes longer than this to be signalled.", "ms", "0"
+    };
+    QCommandLineOption wavesOption { "waves", "Number of start/stop waves.", "count", "10" };
+    QCommandLineOption waveSizeOption { "wave-size", "Number of servers per wave.", "count", "200" };
+    QCommandLineOption staleOption { "stale", "Number of stale sockets to create.", "count", "1000" };
+    QCommandLineOption sandboxesOption { "sandboxes", "Number of concurrent sandboxed servers.", "count", "24" };
+    QCommandLineOption pidReuseOption { "pid-reuse", "Number of pid reuse rounds.", "count", "50" };
+    QCommandLineOption historyOption { "history-records", "Number of session history records.", "count", "1000000" };
+    QCommandLineOption maxQueryOption {
+        "max-query-ms", "Fail if a session history query takes longer than this.", "ms", "0"
+    };
+    parser.addOptions({
+            fakeServerOption,
+            scenarioOption,
+            maxLatencyOption,
+            wavesOption,
+            waveSizeOption,
+            staleOption,
+            sandboxesOption,
+            pidReuseOption,
+            historyOption,
+            maxQueryOption,
+    });
+    parser.process(app);
+
+    QString fakeServer = parser.value(fakeServerOption);
+    if (fakeServer.isEmpty()) {
+        fakeServer = QDir { QCoreApplication::applicationDirPath() }.absoluteFilePath("fake-wineserver");
+    }
+    if (!QFileInfo { fakeServer }.isExecutable()) {
+        qCritical("fake-wineserver not found at %s", qPrintable(fakeServer));
+        return EXIT_FAILURE;
+    }
+
+    QStringList scenarios = parser.values(scenarioOption);
+    auto selected = [&scenarios](const QString &name) { return scenarios.isEmpty() || scenarios.contains(name); };
+
+    raiseFileLimit();
+
+    int waveSize = parser.value(waveSizeOption).toInt();
+    QList<ScenarioStats> results;
+    if (selected("waves")) {
+        results.append(scenarioWaves(fakeServer, parser.value(wavesOption).toInt(), waveSize));
+    }
+    if (selected("stale")) {
+        results.append(scenarioStale(fakeServer, parser.value(staleOption).toInt(), waveSize));
+    }
+    if (selected("slow-listen")) {
+        results.append(scenarioSlowListen(fakeServer, std::min(waveSize, 20)));
+    }
+    if (selected("sandboxes")) {
+        results.append(scenarioSandboxes(fakeServer, parser.value(sandboxesOption).toInt()));
+    }
+    if (selected("pid-reuse")) {
+        results.append(scenarioPidReuse(fakeServer, parser.value(pidReuseOption).toInt()));
+    }
+    if (selected("cgroup")) {
+        results.append(scenarioCgroup());
+    }
+    double maxLatencyMs = parser.value(maxLatencyOption).toDouble();
+    for (auto &stats : results) {
+        checkLatency(stats, maxLatencyMs);
+    }
+    if (!results.isEmpty()) {
+        report(results);
+    }
+    bool historyClean = true;
+    if (selected("history")) {
+        historyClean = benchmarkHistory(parser.value(historyOption).toInt(), parser.value(maxQueryOption).toDouble());
+    }
+
+    bool clean = std::all_of(results.begin(), results.end(), [](const ScenarioStats &stats) {
+        return stats.missedStarts == 0 && stats.missedStops == 0 && stats.duplicates == 0 && stats.failures.isEmpty();
+    });
+    if (!clean || !historyClean) {
+        return EXIT_FAILURE;
+    }
+    bool skipped = !results.isEmpty()
+            && std::all_of(results.begin(), results.end(), [](const ScenarioStats &stats) { return stats.skipped; });
+    return skipped ? kSkippedExitCode : EXIT_SUCCESS;
+}